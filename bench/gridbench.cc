@@ -0,0 +1,300 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <thread>
+#include <vector>
+#include <string>
+
+#include "grid.hh"
+
+#define LOG "gridbench: "
+
+// Every allocation is counted, so lookups can show they make none
+std::atomic<uint64_t> allocations = 0;
+
+void* operator new(std::size_t isize) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+
+	if(void *memory = malloc(isize ? isize : 1))
+		return memory;
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void *imemory) noexcept { free(imemory); }
+void operator delete(void *imemory, std::size_t) noexcept { free(imemory); }
+
+void print_usage(void) {
+	fprintf(stderr,
+LOG R"(usage:
+	gridbench <grid> [seconds]
+)");
+}
+
+// Collect every file path in the table
+void gather_files(const grid::Grid::Table &itable, const grid::Path &ipath, std::vector<grid::Path> &ofiles) {
+	for(std::size_t i = 0; i < itable.directories.size(); ++i)
+		gather_files(itable.tables[i], ipath / std::string(itable.name(itable.directories[i])), ofiles);
+
+	for(const auto &node : itable.files)
+		ofiles.emplace_back(ipath / std::string(itable.name(node)));
+}
+
+struct Result {
+	uint64_t reads;
+	uint64_t bytes;
+	double seconds;
+};
+
+// Read random files from one grid on ithreads threads
+Result run_reads(const grid::Grid &igrid, const std::vector<grid::Path> &ifiles, unsigned ithreads, double iseconds) {
+	std::atomic<bool> stop = false;
+	std::atomic<uint64_t> reads = 0;
+	std::atomic<uint64_t> bytes = 0;
+
+	std::vector<std::thread> workers;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for(unsigned t = 0; t < ithreads; ++t) {
+		workers.emplace_back([&, t](void) -> void {
+			uint64_t state = 0x9e3779b97f4a7c15ull * (t + 1);
+			uint64_t local_reads = 0, local_bytes = 0;
+			std::vector<char> data;
+
+			while(!stop.load(std::memory_order_relaxed)) {
+				// xorshift64
+				state ^= state << 13;
+				state ^= state >> 7;
+				state ^= state << 17;
+
+				if(!igrid.read(ifiles[state % ifiles.size()], data)) {
+					fprintf(stderr, LOG "read failed\n");
+					exit(1);
+				}
+
+				++local_reads;
+				local_bytes += data.size();
+			}
+
+			reads += local_reads;
+			bytes += local_bytes;
+		});
+	}
+
+	std::this_thread::sleep_for(std::chrono::duration<double>(iseconds));
+	stop = true;
+
+	for(std::thread &worker : workers)
+		worker.join();
+
+	std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+
+	return { reads.load(), bytes.load(), took.count() };
+}
+
+// Average time to open the grid, in seconds
+double run_open(const char *ipath, grid::Grid::Load iload) {
+	constexpr unsigned REPEATS = 5;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for(unsigned i = 0; i < REPEATS; ++i)
+		grid::Grid file(ipath, grid::Grid::Mode::STREAM, iload);
+
+	std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+	return took.count() / REPEATS;
+}
+
+struct Batch {
+	double one_by_one;
+	double batched;
+};
+
+// Time to read icount random files one by one and as a single batch
+Batch run_batch(const grid::Grid &igrid, const std::vector<grid::Path> &ifiles, std::size_t icount) {
+	std::vector<std::size_t> offsets;
+	uint64_t state = 0x2545f4914f6cdd1dull;
+
+	for(std::size_t i = 0; i < icount; ++i) {
+		// xorshift64
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+
+		offsets.push_back(igrid.find_file(ifiles[state % ifiles.size()]));
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<char> data;
+	for(std::size_t offset : offsets) {
+		if(!igrid.get_file_content(offset, data)) {
+			fprintf(stderr, LOG "read failed\n");
+			exit(1);
+		}
+	}
+
+	std::chrono::duration<double> one_by_one = std::chrono::steady_clock::now() - start;
+
+	start = std::chrono::steady_clock::now();
+
+	std::vector<std::vector<char>> batch;
+	if(!igrid.get_files_content(offsets, batch)) {
+		fprintf(stderr, LOG "batched read failed\n");
+		exit(1);
+	}
+
+	std::chrono::duration<double> batched = std::chrono::steady_clock::now() - start;
+
+	return { one_by_one.count(), batched.count() };
+}
+
+struct Lookups {
+	double seconds;
+	double allocations;
+};
+
+// Average time and allocations to find a file
+template<typename Find>
+Lookups run_lookups(std::size_t icount, Find ifind, double iseconds) {
+	uint64_t lookups = 0;
+	std::size_t found = 0;
+
+	uint64_t allocated = allocations.load();
+	auto start = std::chrono::steady_clock::now();
+	std::chrono::duration<double> took;
+
+	do {
+		for(std::size_t i = 0; i < icount; ++i) {
+			// Stride through the files so neighbours are not looked up one after another
+			found += ifind((i * 7919) % icount) != 0;
+		}
+
+		lookups += icount;
+		took = std::chrono::steady_clock::now() - start;
+	} while(took.count() < iseconds);
+
+	allocated = allocations.load() - allocated;
+
+	if(found != lookups) {
+		fprintf(stderr, LOG "lookup failed\n");
+		exit(1);
+	}
+
+	return { took.count() / lookups, (double)allocated / lookups };
+}
+
+int main(int argc, char **argv) {
+	if(argc < 2 || argc > 3) {
+		print_usage(); return 1;
+	}
+
+	double seconds = argc == 3 ? atof(argv[2]) : 1.0;
+	if(seconds <= 0) {
+		print_usage(); return 1;
+	}
+
+	unsigned cores = std::thread::hardware_concurrency();
+	if(cores == 0)
+		cores = 1;
+
+	std::vector<unsigned> thread_counts;
+	for(unsigned t = 1; t < cores; t *= 2)
+		thread_counts.push_back(t);
+	thread_counts.push_back(cores);
+
+	fprintf(stdout, "\t\033[37m'%s' open:\033[m\n", argv[1]);
+	fprintf(stdout, "%8s %12.3f ms\n", "eager", run_open(argv[1], grid::Grid::Load::EAGER) * 1000.0);
+	fprintf(stdout, "%8s %12.3f ms\n", "lazy", run_open(argv[1], grid::Grid::Load::LAZY) * 1000.0);
+	fputc('\n', stdout);
+
+	{
+		grid::Grid file(argv[1]);
+
+		std::vector<grid::Path> files;
+		gather_files(file.table, grid::Path(), files);
+
+		if(files.empty()) {
+			fprintf(stderr, LOG "grid has no files\n");
+			return 1;
+		}
+
+		std::vector<std::string> strings;
+		for(const grid::Path &path : files)
+			strings.emplace_back(path.string());
+
+		// Lazy tables get read in here, not while counting
+		for(const grid::Path &path : files)
+			file.find_file(path);
+
+		Lookups by_path = run_lookups(files.size(),
+			[&](std::size_t i) -> std::size_t { return file.find_file(files[i]); }, seconds);
+		Lookups by_string = run_lookups(strings.size(),
+			[&](std::size_t i) -> std::size_t { return file.find_file(strings[i]); }, seconds);
+		Lookups by_new_path = run_lookups(strings.size(),
+			[&](std::size_t i) -> std::size_t { return file.find_file(grid::Path(strings[i])); }, seconds);
+
+		fprintf(stdout, "\t\033[37m'%s' lookups, %s:\033[m\n", argv[1], file.is_indexed() ? "indexed" : "tables");
+		fprintf(stdout, "%12s %12s %14s\n", "by", "ns", "allocs/lookup");
+		fprintf(stdout, "%12s %12.1f %14.2f\n", "path", by_path.seconds * 1e9, by_path.allocations);
+		fprintf(stdout, "%12s %12.1f %14.2f\n", "string", by_string.seconds * 1e9, by_string.allocations);
+		fprintf(stdout, "%12s %12.1f %14.2f\n", "new path", by_new_path.seconds * 1e9, by_new_path.allocations);
+		fputc('\n', stdout);
+	}
+
+	{
+		constexpr std::size_t BATCH_FILES = 5000;
+
+		grid::Grid file(argv[1]);
+
+		std::vector<grid::Path> files;
+		gather_files(file.table, grid::Path(), files);
+
+		std::size_t count = files.size() < BATCH_FILES ? files.size() : BATCH_FILES;
+		Batch batch = run_batch(file, files, count);
+
+		fprintf(stdout, "\t\033[37m'%s' %zu random files, stream:\033[m\n", argv[1], count);
+		fprintf(stdout, "%12s %12.3f ms\n", "one by one", batch.one_by_one * 1000.0);
+		fprintf(stdout, "%12s %12.3f ms\n", "batched", batch.batched * 1000.0);
+		fputc('\n', stdout);
+	}
+
+	for(grid::Grid::Mode mode : { grid::Grid::Mode::STREAM, grid::Grid::Mode::MAP }) {
+		grid::Grid file(argv[1], mode);
+
+		std::vector<grid::Path> files;
+		gather_files(file.table, grid::Path(), files);
+
+		if(files.empty()) {
+			fprintf(stderr, LOG "grid has no files\n");
+			return 1;
+		}
+
+		fprintf(stdout, "\t\033[37m'%s' reads, %s, %zu files:\033[m\n",
+			argv[1], file.is_mapped() ? "mapped" : "stream", files.size());
+		fprintf(stdout, "%8s %14s %12s %8s\n", "threads", "reads/s", "MB/s", "speedup");
+
+		double single = 0;
+
+		for(unsigned threads : thread_counts) {
+			Result result = run_reads(file, files, threads, seconds);
+
+			double rate = result.reads / result.seconds;
+			if(threads == 1)
+				single = rate;
+
+			fprintf(stdout, "%8u %14.0f %12.1f %7.2fx\n",
+				threads, rate, result.bytes / result.seconds / (1024.0 * 1024.0),
+				single > 0 ? rate / single : 0.0);
+		}
+
+		fputc('\n', stdout);
+	}
+
+	return 0;
+}
@@ -0,0 +1,152 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <string>
+
+#include "grid.hh"
+#include "image.hh"
+
+#define LOG "gridfaults: "
+
+#if GRID_URING
+	#include <dlfcn.h>
+
+// Fail every io_uring submission while this is set
+std::atomic<bool> refuse_submissions = false;
+
+// Stands in for the libc one, grid reaches the kernel through it
+extern "C" long syscall(long inumber, ...) noexcept {
+	va_list list;
+	va_start(list, inumber);
+
+	long args[6];
+	for(long &arg : args)
+		arg = va_arg(list, long);
+
+	va_end(list);
+
+	if(inumber == __NR_io_uring_enter && args[1] > 0 && refuse_submissions) {
+		errno = EIO;
+		return -1;
+	}
+
+	static long (*real)(long, ...) = (long (*)(long, ...))dlsym(RTLD_NEXT, "syscall");
+	return real(inumber, args[0], args[1], args[2], args[3], args[4], args[5]);
+}
+#endif
+
+constexpr unsigned FILES = 64;
+
+// Pack FILES small files into iworkdir/faults.grid
+bool make_image(const std::filesystem::path &iworkdir, std::vector<std::string> &ocontents) {
+	std::filesystem::path root = iworkdir / "root";
+	std::filesystem::create_directories(root);
+
+	for(unsigned i = 0; i < FILES; ++i) {
+		std::string content;
+
+		for(unsigned line = 0; line <= i; ++line)
+			content += "file " + std::to_string(i) + " line " + std::to_string(line) + "\n";
+
+		std::ofstream(root / ("f" + std::to_string(i)), std::ios::binary) << content;
+		ocontents.push_back(content);
+	}
+
+	std::filesystem::path gridfile = iworkdir / ".gridfile";
+	std::ofstream(gridfile) << root.string() << '\n' << (iworkdir / "faults.grid").string() << '\n';
+
+	return image(gridfile, 1);
+}
+
+// Read every file through ureads, count the reads that succeeded
+// with the right content and the ones that failed
+void read_all(grid::Grid::Async &ureads, const std::vector<std::string> &icontents, unsigned &oright, unsigned &ofailed) {
+	std::atomic<unsigned> right = 0, failed = 0;
+
+	for(unsigned i = 0; i < FILES; ++i) {
+		const std::string &content = icontents[i];
+
+		ureads.read("/f" + std::to_string(i), [&right, &failed, &content](bool iread, std::vector<char> &&idata) -> void {
+			if(!iread)
+				++failed;
+			else if(std::string(idata.begin(), idata.end()) == content)
+				++right;
+		});
+	}
+
+	ureads.wait();
+
+	oright = right;
+	ofailed = failed;
+}
+
+#if GRID_URING
+// Read with submissions refused and then taken again, false if
+// a read hangs or comes out wrong
+bool check_refused(const std::filesystem::path &iimage, const std::vector<std::string> &icontents) {
+	grid::Grid faults(iimage);
+	grid::Grid::Async reads(faults);
+
+	if(!reads.is_uring()) {
+		fprintf(stderr, LOG "io_uring cannot be set up, nothing to check\n");
+		return true;
+	}
+
+	unsigned right, failed;
+
+	// Refused submissions fail their reads, wait() returns
+
+	refuse_submissions = true;
+	read_all(reads, icontents, right, failed);
+	refuse_submissions = false;
+
+	if(failed != FILES) {
+		fprintf(stderr, LOG "%u of %u refused reads failed\n", failed, FILES);
+		return false;
+	}
+
+	// The ring still works once the kernel takes entries again
+
+	read_all(reads, icontents, right, failed);
+
+	if(right != FILES) {
+		fprintf(stderr, LOG "%u of %u reads right after the failures\n", right, FILES);
+		return false;
+	}
+
+	// Closes with submissions refused
+	refuse_submissions = true;
+	return true;
+}
+#endif
+
+int main(void) {
+#if !GRID_URING
+	fprintf(stderr, LOG "no io_uring here, nothing to check\n");
+	return 0;
+#else
+	std::filesystem::path workdir = std::filesystem::temp_directory_path() / ("gridfaults-" + std::to_string(getpid()));
+	std::vector<std::string> contents;
+	bool passed = false;
+
+	if(!make_image(workdir, contents))
+		fprintf(stderr, LOG "unable to pack the image\n");
+	else
+		passed = check_refused(workdir / "faults.grid", contents);
+
+	refuse_submissions = false;
+	std::filesystem::remove_all(workdir);
+
+	if(passed)
+		fprintf(stderr, LOG "refused submissions fail their reads\n");
+
+	return passed ? 0 : 1;
+#endif
+}
@@ -0,0 +1,436 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+	#define SUITE_POSIX 1
+
+	#include <sys/resource.h>
+	#include <sys/wait.h>
+	#include <unistd.h>
+#else
+	#define SUITE_POSIX 0
+#endif
+
+#include "grid.hh"
+#include "image.hh"
+
+#define LOG "gridsuite: "
+
+void print_usage(void) {
+	fprintf(stderr,
+LOG R"(usage:
+	gridsuite [-q] [-k] [-s seconds] [-d workdir]
+
+	-q	quick run, every tree is a tenth of its size
+	-k	keep the trees and images in the workdir
+	-s	how long each read run lasts, one by default
+	-d	where trees are made, a temporary directory by default
+)");
+}
+
+// Synthetic tree, every directory has the same shape
+struct Shape {
+	const char *name;
+	// directories in every directory
+	unsigned fanout;
+	// levels of directories under the root
+	unsigned depth;
+	// files in every directory
+	unsigned files;
+	// file sizes are spread evenly on a log scale between these
+	size_t min_size;
+	size_t max_size;
+	// gridfile compress option
+	const char *codec;
+};
+
+const Shape SHAPES[] = {
+	{ "wide",         0,  0, 20000,         256,         4096, "none" },
+	{ "deep",         2, 10,     8,         256,         4096, "none" },
+	{ "balanced",    16,  2,    32,         128,    32 * 1024, "none" },
+	{ "balanced_lz4", 16, 2,    32,         128,    32 * 1024, "lz4"  },
+	{ "large",        2,  1,     8, 1024 * 1024, 8 * 1024 * 1024, "none" },
+};
+
+// Files up to this are small reads, from this on large ones
+constexpr size_t SMALL_READ_MAX = 64 * 1024;
+constexpr size_t LARGE_READ_MIN = 1024 * 1024;
+
+struct Random {
+	uint64_t state;
+
+	// xorshift64
+	uint64_t next(void) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return state;
+	}
+
+	// Between 0 and 1
+	double unit(void) { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+};
+
+// Fill with words, so that the content compresses about as well as text
+void fill_content(Random &urandom, uint64_t iid, size_t isize, std::vector<char> &odata) {
+	static const char *WORDS[] = {
+		"grid ", "table ", "entry ", "offset ", "texture ", "sound ", "level ", "shader ",
+		"mesh ", "sprite ", "0x3f ", "{ ", "} ", "\n", "\t", "=",
+	};
+
+	odata.resize(isize);
+
+	// Every file starts differently, so none of them are deduplicated
+	size_t at = isize < sizeof(iid) ? isize : sizeof(iid);
+	memcpy(odata.data(), &iid, at);
+
+	while(at < isize) {
+		const char *word = WORDS[urandom.next() % (sizeof(WORDS) / sizeof(WORDS[0]))];
+		size_t length = strlen(word) < isize - at ? strlen(word) : isize - at;
+
+		memcpy(odata.data() + at, word, length);
+		at += length;
+	}
+}
+
+struct Tree {
+	std::vector<std::string> files;
+	std::vector<size_t> sizes;
+	size_t directories = 0;
+	size_t bytes = 0;
+};
+
+bool make_directory(const Shape &ishape, unsigned iscale, Random &urandom, const std::filesystem::path &ipath, const std::string &iprefix, unsigned ilevel, Tree &otree) {
+	std::error_code error;
+	std::filesystem::create_directories(ipath, error);
+
+	if(error) {
+		fprintf(stderr, LOG "unable to make directory: %s\n", ipath.c_str());
+		return false;
+	}
+
+	++otree.directories;
+
+	unsigned files = ishape.files / iscale ? ishape.files / iscale : 1;
+	std::vector<char> data;
+
+	for(unsigned i = 0; i < files; ++i) {
+		double ratio = (double)ishape.max_size / ishape.min_size;
+		size_t size = (size_t)(ishape.min_size * pow(ratio, urandom.unit()));
+
+		std::string name = "file" + std::to_string(i) + ".bin";
+
+		fill_content(urandom, otree.files.size(), size, data);
+
+		std::ofstream out(ipath / name, std::ios::binary);
+		if(!out.write(data.data(), data.size())) {
+			fprintf(stderr, LOG "unable to write file: %s\n", (ipath / name).c_str());
+			return false;
+		}
+
+		otree.files.push_back(iprefix + name);
+		otree.sizes.push_back(size);
+		otree.bytes += size;
+	}
+
+	if(ilevel >= ishape.depth)
+		return true;
+
+	for(unsigned i = 0; i < ishape.fanout; ++i) {
+		std::string name = "dir" + std::to_string(i);
+
+		if(!make_directory(ishape, iscale, urandom, ipath / name, iprefix + name + "/", ilevel + 1, otree))
+			return false;
+	}
+
+	return true;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point istart) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - istart).count();
+}
+
+// Median time to open the grid, in seconds
+double run_open(const std::filesystem::path &iimage, grid::Grid::Load iload) {
+	constexpr unsigned REPEATS = 7;
+	std::vector<double> times;
+
+	for(unsigned i = 0; i < REPEATS; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		grid::Grid file(iimage, grid::Grid::Mode::STREAM, iload);
+		times.push_back(seconds_since(start));
+	}
+
+	std::sort(times.begin(), times.end());
+	return times[REPEATS / 2];
+}
+
+struct Percentiles {
+	double p50, p90, p99, max;
+};
+
+// Time every lookup on its own, in random order
+template<typename Find>
+Percentiles run_lookups(size_t icount, Find ifind) {
+	constexpr size_t LOOKUPS = 100000;
+
+	std::vector<double> times;
+	times.reserve(LOOKUPS);
+
+	Random random = { 0x2545f4914f6cdd1dull };
+	size_t found = 0;
+
+	for(size_t i = 0; i < LOOKUPS; ++i) {
+		size_t index = random.next() % icount;
+
+		auto start = std::chrono::steady_clock::now();
+		found += ifind(index) != 0;
+		times.push_back(seconds_since(start) * 1e9);
+	}
+
+	if(found != LOOKUPS) {
+		fprintf(stderr, LOG "lookup failed\n");
+		exit(1);
+	}
+
+	std::sort(times.begin(), times.end());
+
+	auto at = [&times](double ifraction) -> double { return times[(size_t)(ifraction * (times.size() - 1))]; };
+
+	return { at(0.50), at(0.90), at(0.99), times.back() };
+}
+
+struct Throughput {
+	size_t files = 0;
+	double reads_per_second = 0;
+	double mb_per_second = 0;
+};
+
+// Read random files out of the picked ones for iseconds
+Throughput run_reads(const grid::Grid &igrid, const std::vector<size_t> &ioffsets, double iseconds) {
+	Throughput result;
+	result.files = ioffsets.size();
+
+	if(ioffsets.empty())
+		return result;
+
+	Random random = { 0x9e3779b97f4a7c15ull };
+	std::vector<char> data;
+	uint64_t reads = 0, bytes = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	double took;
+
+	do {
+		for(unsigned i = 0; i < 16; ++i) {
+			if(!igrid.get_file_content(ioffsets[random.next() % ioffsets.size()], data)) {
+				fprintf(stderr, LOG "read failed\n");
+				exit(1);
+			}
+
+			++reads;
+			bytes += data.size();
+		}
+
+		took = seconds_since(start);
+	} while(took < iseconds);
+
+	result.reads_per_second = reads / took;
+	result.mb_per_second = bytes / took / (1024.0 * 1024.0);
+	return result;
+}
+
+// Peak resident memory of this process so far, in KiB
+long peak_rss_kb(void) {
+#if SUITE_POSIX
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) != 0)
+		return -1;
+
+#if defined(__APPLE__)
+	return usage.ru_maxrss / 1024;
+#else
+	return usage.ru_maxrss;
+#endif
+#else
+	return -1;
+#endif
+}
+
+void print_throughput(const char *iname, const Throughput &ithroughput) {
+	if(!ithroughput.files) {
+		fprintf(stdout, ",\"%s\":null", iname);
+		return;
+	}
+
+	fprintf(stdout, ",\"%s\":{\"files\":%zu,\"reads_per_s\":%.1f,\"mb_per_s\":%.2f}",
+		iname, ithroughput.files, ithroughput.reads_per_second, ithroughput.mb_per_second);
+}
+
+void print_percentiles(const char *iname, const Percentiles &ipercentiles) {
+	fprintf(stdout, ",\"%s\":{\"p50_ns\":%.1f,\"p90_ns\":%.1f,\"p99_ns\":%.1f,\"max_ns\":%.1f}",
+		iname, ipercentiles.p50, ipercentiles.p90, ipercentiles.p99, ipercentiles.max);
+}
+
+// Make, pack and measure one tree, prints a single JSON line
+bool run_shape(const Shape &ishape, unsigned iscale, double iseconds, const std::filesystem::path &iworkdir, bool ikeep) {
+	std::filesystem::path dir = iworkdir / ishape.name;
+	std::filesystem::path root = dir / "root";
+	std::filesystem::path image_path = dir / "image.grid";
+	std::filesystem::path gridfile = dir / ".gridfile";
+
+	std::error_code error;
+	std::filesystem::remove_all(dir, error);
+
+	fprintf(stderr, LOG "%s: making tree\n", ishape.name);
+
+	Tree tree;
+	Random random = { 0x853c49e6748fea9bull };
+
+	if(!make_directory(ishape, iscale, random, root, "", 0, tree))
+		return false;
+
+	{
+		std::ofstream out(gridfile);
+		out << root.string() << '\n' << image_path.string() << '\n' << "compress " << ishape.codec << '\n';
+
+		if(!out) {
+			fprintf(stderr, LOG "unable to write gridfile: %s\n", gridfile.c_str());
+			return false;
+		}
+	}
+
+	fprintf(stderr, LOG "%s: packing %zu files\n", ishape.name, tree.files.size());
+
+	auto pack_start = std::chrono::steady_clock::now();
+
+	if(!image(gridfile, 1)) {
+		fprintf(stderr, LOG "unable to pack: %s\n", gridfile.c_str());
+		return false;
+	}
+
+	double pack_seconds = seconds_since(pack_start);
+
+	fprintf(stderr, LOG "%s: measuring\n", ishape.name);
+
+	double open_eager = run_open(image_path, grid::Grid::Load::EAGER);
+	double open_lazy = run_open(image_path, grid::Grid::Load::LAZY);
+
+	grid::Grid file(image_path);
+
+	std::vector<grid::Path> paths;
+	for(const std::string &path : tree.files)
+		paths.emplace_back(path);
+
+	Percentiles by_string = run_lookups(tree.files.size(),
+		[&](size_t i) -> size_t { return file.find_file(tree.files[i]); });
+
+	// Tables only, through find_parent_table()
+	Percentiles by_table = run_lookups(paths.size(),
+		[&](size_t i) -> size_t { return file.find_file(paths[i], file.table); });
+
+	std::vector<size_t> small, large;
+
+	for(size_t i = 0; i < tree.files.size(); ++i) {
+		if(tree.sizes[i] <= SMALL_READ_MAX)
+			small.push_back(file.find_file(tree.files[i]));
+		else if(tree.sizes[i] >= LARGE_READ_MIN)
+			large.push_back(file.find_file(tree.files[i]));
+	}
+
+	Throughput small_reads = run_reads(file, small, iseconds);
+	Throughput large_reads = run_reads(file, large, iseconds);
+
+	fprintf(stdout, "{\"suite\":\"gridsuite\",\"shape\":\"%s\",\"codec\":\"%s\",\"files\":%zu,\"directories\":%zu,\"bytes\":%zu",
+		ishape.name, ishape.codec, tree.files.size(), tree.directories, tree.bytes);
+	fprintf(stdout, ",\"image_bytes\":%ju,\"indexed\":%s,\"pack_s\":%.4f",
+		(uintmax_t)std::filesystem::file_size(image_path), file.is_indexed() ? "true" : "false", pack_seconds);
+	fprintf(stdout, ",\"open_eager_ms\":%.4f,\"open_lazy_ms\":%.4f", open_eager * 1000.0, open_lazy * 1000.0);
+	print_percentiles("lookup_string", by_string);
+	print_percentiles("lookup_table", by_table);
+	print_throughput("small_reads", small_reads);
+	print_throughput("large_reads", large_reads);
+	fprintf(stdout, ",\"peak_rss_kb\":%ld}\n", peak_rss_kb());
+	fflush(stdout);
+
+	if(!ikeep)
+		std::filesystem::remove_all(dir, error);
+
+	return true;
+}
+
+int main(int argc, char **argv) {
+	unsigned scale = 1;
+	bool keep = false;
+	double seconds = 1.0;
+	std::filesystem::path workdir;
+
+	for(int arg = 1; arg < argc; ++arg) {
+		if(strcmp(argv[arg], "-q") == 0) {
+			scale = 10;
+		} else if(strcmp(argv[arg], "-k") == 0) {
+			keep = true;
+		} else if(strcmp(argv[arg], "-s") == 0 && arg + 1 < argc) {
+			seconds = atof(argv[++arg]);
+		} else if(strcmp(argv[arg], "-d") == 0 && arg + 1 < argc) {
+			workdir = argv[++arg];
+		} else {
+			print_usage(); return 1;
+		}
+	}
+
+	if(seconds <= 0) {
+		print_usage(); return 1;
+	}
+
+	if(workdir.empty())
+		workdir = std::filesystem::temp_directory_path() / "gridsuite";
+
+	workdir = std::filesystem::absolute(workdir);
+
+	int failed = 0;
+
+	for(const Shape &shape : SHAPES) {
+#if SUITE_POSIX
+		// Every shape runs in a process of its own, so the peak
+		// memory it reports is its own
+		pid_t child = fork();
+
+		if(child < 0) {
+			fprintf(stderr, LOG "unable to fork\n");
+			return 1;
+		}
+
+		if(child == 0)
+			_exit(run_shape(shape, scale, seconds, workdir, keep) ? 0 : 1);
+
+		int status = 0;
+		if(waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			fprintf(stderr, LOG "%s: failed\n", shape.name);
+			failed = 1;
+		}
+#else
+		if(!run_shape(shape, scale, seconds, workdir, keep)) {
+			fprintf(stderr, LOG "%s: failed\n", shape.name);
+			failed = 1;
+		}
+#endif
+	}
+
+	if(!keep) {
+		std::error_code error;
+		std::filesystem::remove(workdir, error);
+	}
+
+	return failed;
+}
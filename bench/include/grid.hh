@@ -0,0 +1 @@
+../../grid/grid.hh
\ No newline at end of file
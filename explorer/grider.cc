@@ -2,9 +2,11 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <chrono>
 #include <filesystem>
 #include <vector>
 #include <string>
+#include <span>
 
 #include "grid.hh"
 
@@ -14,12 +16,13 @@ enum class Command : uint8_t {
 	NONE,
 	LS,
 	CAT,
+	VERIFY,
 };
 
 void print_usage(void) {
 	fprintf(stderr,
 LOG R"(usage:
-	grider <grid> ( ls | cat ) <path>
+	grider <grid> ( ls | cat | verify ) <path>
 )");
 }
 
@@ -35,47 +38,121 @@ int cat(grid::Grid &ifile, grid::Path &ipath) {
 		return -1;
 	}
 
-	std::vector<char> content;
-	if(!ifile.get_file_content(offset, content)) {
+	std::span<const std::byte> view;
+	if(ifile.view_file_content(offset, view)) {
+		fwrite(view.data(), 1, view.size(), stdout);
+		return 0;
+	}
+
+	// Stream it through a fixed buffer, big files do not have to fit in memory
+	grid::Grid::Reader reader;
+	if(!ifile.open_file_content(offset, reader)) {
 		fprintf(stderr, LOG "unable to read file content\n");
 		return -1;
 	}
 
-	for(const char c : content)
-		fputc(c, stdout);
+	char buffer[64 * 1024];
+	std::size_t got;
+
+	while((got = reader.read(buffer, sizeof(buffer))) > 0)
+		fwrite(buffer, 1, got, stdout);
+
+	if(reader.failed()) {
+		fprintf(stderr, LOG "unable to read file content\n");
+		return -1;
+	}
 
 	return 0;
 }
 
 int ls(grid::Grid &ifile, grid::Path &ipath) {
-	auto print_table = [&ipath](grid::Grid::Table& itable) -> void {
-		fprintf(stdout, "\t\033[37m'%s':\033[m\n", ipath.string().c_str());
+	grid::Grid::Directory directory;
 
-		for(const auto &[key, _] : itable.nested)
-			fprintf(stdout, "\033[34m%s\033[m\n", key.c_str());
+	if(!ifile.find_directory(ipath, directory)) {
+		fprintf(stderr, LOG "unable to find directory\n");
+		return -1;
+	}
+
+	fprintf(stdout, "\t\033[37m'%s':\033[m\n", ipath.string().c_str());
+
+	for(const grid::Grid::DirectoryEntry &entry : directory) {
+		fprintf(stdout, "\033[%dm%.*s\033[m\n",
+			entry.is_directory() ? 34 : 32, (int)entry.name.size(), entry.name.data());
+	}
+
+	fputc('\n', stdout);
 
-		for(const auto &[key, _] : itable.contained)
-			fprintf(stdout, "\033[32m%s\033[m\n", key.c_str());
+	return 0;
+}
+
+struct Verified {
+	std::size_t files = 0;
+	std::size_t unchecked = 0;
+	std::size_t bad = 0;
+	std::size_t bytes = 0;
+};
 
-		fputc('\n', stdout);
+void verify_file(grid::Grid &ifile, std::size_t ioffset, const std::string &ipath, Verified &overified) {
+	grid::Grid::Header header;
+	++overified.files;
+
+	if(!ifile.get_file_header(ioffset, header) || !ifile.verify_file_content(ioffset)) {
+		fprintf(stderr, LOG "corrupted: %s\n", ipath.c_str());
+		++overified.bad;
 		return;
-	};
+	}
 
-	if(ipath.empty()) {
-		print_table(ifile.table);
-		return 0;
+	overified.bytes += header.stored;
+
+	if(!header.checksummed)
+		++overified.unchecked;
+}
+
+// Verify every file in the directory and in nested ones
+void verify_directory(grid::Grid &ifile, const grid::Grid::Directory &idirectory, const grid::Path &ipath, Verified &overified) {
+	grid::Grid::Walk walk = ifile.walk(idirectory);
+	std::string prefix = ipath.string();
+
+	if(prefix.empty() || prefix.back() != '/')
+		prefix += '/';
+
+	std::string path;
+
+	for(const grid::Grid::DirectoryEntry &entry : walk) {
+		if(entry.is_directory())
+			continue;
+
+		path.assign(prefix).append(entry.path);
+		verify_file(ifile, entry.target, path, overified);
 	}
 
-	grid::Grid::Table table;
+	if(walk.failed()) {
+		fprintf(stderr, LOG "unable to read %zu directories\n", walk.failed());
+		overified.bad += walk.failed();
+	}
+}
 
-	if(!ifile.find_directory(ipath, table)) {
-		fprintf(stderr, LOG "unable to find directory\n");
+int verify(grid::Grid &ifile, grid::Path &ipath) {
+	Verified verified;
+	auto start = std::chrono::steady_clock::now();
+
+	grid::Grid::Directory directory;
+
+	if(std::size_t offset = ifile.find_file(ipath)) {
+		verify_file(ifile, offset, ipath.string(), verified);
+	} else if(ifile.find_directory(ipath, directory)) {
+		verify_directory(ifile, directory, ipath, verified);
+	} else {
+		fprintf(stderr, LOG "unable to find path\n");
 		return -1;
 	}
 
-	print_table(table);
+	std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
 
-	return 0;
+	fprintf(stdout, "%zu files, %zu corrupted, %zu without checksum, %.1f MB in %.3f s\n",
+		verified.files, verified.bad, verified.unchecked, verified.bytes / (1024.0 * 1024.0), took.count());
+
+	return verified.bad ? -1 : 0;
 }
 
 int main(int argc, char **argv) {
@@ -89,16 +166,19 @@ int main(int argc, char **argv) {
 		cmd = Command::LS;
 	else if(strcmp("cat", argv[2]) == 0)
 		cmd = Command::CAT;
+	else if(strcmp("verify", argv[2]) == 0)
+		cmd = Command::VERIFY;
 	else {
 		print_usage(); return 1;
 	}
 
-	grid::Grid file(argv[1]);
+	grid::Grid file(argv[1], grid::Grid::Mode::MAP, grid::Grid::Load::LAZY);
 	grid::Path path(argv[3]);
 
 	switch(cmd) {
 		case Command::LS: return(ls(file, path)); break;
 		case Command::CAT: return(cat(file, path)); break;
+		case Command::VERIFY: return(verify(file, path)); break;
 		default: print_usage(); return 1; break;
 	}
 
@@ -25,17 +25,217 @@
 #pragma once
 
 #include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
 
 #include <fstream>
+#include <streambuf>
 #include <filesystem>
 
 #include <vector>
 #include <string>
-
+#include <span>
+#include <atomic>
+
+#include <algorithm>
+#include <string_view>
+#include <concepts>
+#include <iterator>
+#include <bit>
+
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <future>
+#include <functional>
+#include <condition_variable>
+#include <deque>
+#include <coroutine>
+#include <list>
 #include <unordered_map>
 
+#if defined(__unix__) || defined(__APPLE__)
+	#define GRID_POSIX 1
+
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#else
+	#define GRID_POSIX 0
+#endif
+
+// Async reads go through io_uring where it is there, define
+// GRID_URING to 0 to always read on threads instead
+#if !defined(GRID_URING)
+	#if defined(__linux__) && defined(__has_include)
+		#if __has_include(<linux/io_uring.h>)
+			#define GRID_URING 1
+		#else
+			#define GRID_URING 0
+		#endif
+	#else
+		#define GRID_URING 0
+	#endif
+#endif
+
+#if GRID_URING
+	#include <sys/syscall.h>
+	#include <sys/uio.h>
+	#include <linux/io_uring.h>
+#endif
+
+// Checksums use the CRC instructions of the CPU where there are
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+	#define GRID_CRC_X86 1
+	#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+	#define GRID_CRC_ARM 1
+	#include <arm_acle.h>
+#endif
+
 namespace {
 	constexpr std::uint8_t SIZE_SIZE = sizeof(std::size_t);
+
+	// CRC32C (Castagnoli) polynomial, bit reversed
+	constexpr std::uint32_t CRC_POLY = 0x82f63b78u;
+
+	// Tables for slicing by 8 bytes when there are no CRC instructions
+	struct CrcTables {
+		std::uint32_t t[8][256];
+
+		constexpr CrcTables(void) : t() {
+			for(std::uint32_t i = 0; i < 256; ++i) {
+				std::uint32_t crc = i;
+
+				for(int k = 0; k < 8; ++k)
+					crc = crc & 1 ? (crc >> 1) ^ CRC_POLY : crc >> 1;
+
+				t[0][i] = crc;
+			}
+
+			for(std::uint32_t i = 0; i < 256; ++i) {
+				for(int k = 1; k < 8; ++k)
+					t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+			}
+		}
+	};
+
+	constexpr CrcTables CRC_TABLES;
+
+	inline std::uint32_t crc_software(std::uint32_t icrc, const std::uint8_t *idata, std::size_t isize) noexcept {
+		const auto &t = CRC_TABLES.t;
+
+		for(; isize >= 8; isize -= 8, idata += 8) {
+			std::uint64_t word = 0;
+
+			if constexpr(std::endian::native == std::endian::little)
+				std::memcpy(&word, idata, sizeof(word));
+			else {
+				for(int i = 0; i < 8; ++i)
+					word |= (std::uint64_t)idata[i] << (8 * i);
+			}
+
+			word ^= icrc;
+
+			icrc = t[7][word & 0xFF] ^ t[6][(word >> 8) & 0xFF] ^ t[5][(word >> 16) & 0xFF] ^ t[4][(word >> 24) & 0xFF]
+				^ t[3][(word >> 32) & 0xFF] ^ t[2][(word >> 40) & 0xFF] ^ t[1][(word >> 48) & 0xFF] ^ t[0][word >> 56];
+		}
+
+		for(; isize; --isize)
+			icrc = (icrc >> 8) ^ t[0][(icrc ^ *idata++) & 0xFF];
+
+		return icrc;
+	}
+
+	// a * b modulo the polynomial, bit 31 is x^0
+	constexpr std::uint32_t crc_multiply(std::uint32_t ia, std::uint32_t ib) noexcept {
+		std::uint32_t product = 0;
+
+		for(std::uint32_t m = 1u << 31; m; m >>= 1) {
+			if(ia & m)
+				product ^= ib;
+
+			ib = ib & 1 ? (ib >> 1) ^ CRC_POLY : ib >> 1;
+		}
+
+		return product;
+	}
+
+	// x^(8 * ibytes) modulo the polynomial, multiplying a CRC by it
+	// is the same as running it over ibytes zero bytes
+	constexpr std::uint32_t crc_zeros(std::size_t ibytes) noexcept {
+		std::uint32_t result = 1u << 31;
+		std::uint32_t square = 1u << 23;
+
+		for(; ibytes; ibytes >>= 1) {
+			if(ibytes & 1)
+				result = crc_multiply(result, square);
+
+			square = crc_multiply(square, square);
+		}
+
+		return result;
+	}
+
+#if GRID_CRC_X86 || GRID_CRC_ARM
+	// The CRC instruction takes a few cycles to finish, but a new
+	// one can start every cycle, so three independent stripes run
+	// at once and are joined after
+	constexpr std::size_t CRC_STRIPE = 8 * 1024;
+	constexpr std::uint32_t CRC_STRIPE_ZEROS = crc_zeros(CRC_STRIPE);
+
+	#if GRID_CRC_X86
+		__attribute__((target("sse4.2")))
+		inline std::uint32_t crc_word(std::uint32_t icrc, std::uint64_t iword) noexcept { return (std::uint32_t)_mm_crc32_u64(icrc, iword); }
+
+		__attribute__((target("sse4.2")))
+		inline std::uint32_t crc_byte(std::uint32_t icrc, std::uint8_t ibyte) noexcept { return _mm_crc32_u8(icrc, ibyte); }
+
+		#define GRID_CRC_TARGET __attribute__((target("sse4.2")))
+	#else
+		inline std::uint32_t crc_word(std::uint32_t icrc, std::uint64_t iword) noexcept { return __crc32cd(icrc, iword); }
+		inline std::uint32_t crc_byte(std::uint32_t icrc, std::uint8_t ibyte) noexcept { return __crc32cb(icrc, ibyte); }
+
+		#define GRID_CRC_TARGET
+	#endif
+
+	GRID_CRC_TARGET
+	inline std::uint32_t crc_hardware(std::uint32_t icrc, const std::uint8_t *idata, std::size_t isize) noexcept {
+		std::uint64_t word;
+
+		while(isize >= 3 * CRC_STRIPE) {
+			std::uint32_t crc_a = icrc, crc_b = 0, crc_c = 0;
+
+			for(std::size_t at = 0; at < CRC_STRIPE; at += 8) {
+				std::memcpy(&word, idata + at, 8);
+				crc_a = crc_word(crc_a, word);
+				std::memcpy(&word, idata + CRC_STRIPE + at, 8);
+				crc_b = crc_word(crc_b, word);
+				std::memcpy(&word, idata + 2 * CRC_STRIPE + at, 8);
+				crc_c = crc_word(crc_c, word);
+			}
+
+			icrc = crc_multiply(crc_multiply(crc_a, CRC_STRIPE_ZEROS) ^ crc_b, CRC_STRIPE_ZEROS) ^ crc_c;
+
+			idata += 3 * CRC_STRIPE;
+			isize -= 3 * CRC_STRIPE;
+		}
+
+		for(; isize >= 8; isize -= 8, idata += 8) {
+			std::memcpy(&word, idata, 8);
+			icrc = crc_word(icrc, word);
+		}
+
+		for(; isize; --isize)
+			icrc = crc_byte(icrc, *idata++);
+
+		return icrc;
+	}
+
+	#undef GRID_CRC_TARGET
+#endif
 }
 
 namespace grid {
@@ -110,8 +310,8 @@ public:
 
 	Path parent_path(void) const {
 		if(!has_parent_path()) { return *this; }
-		Path new_path = *this;
-		new_path.path.erase(new_path.path.end() - 1);
+		Path new_path;
+		new_path.path.assign(path.begin(), path.end() - 1);
 		return new_path;
 	}
 
@@ -179,7 +379,9 @@ public:
 	}
 
 	Path operator/(const Path &ipath) const {
-		Path new_path = *this;
+		Path new_path;
+		new_path.path.reserve(path.size() + ipath.path.size());
+		new_path.path.insert(new_path.path.end(), path.begin(), path.end());
 		new_path.path.insert(new_path.path.end(), ipath.path.begin(), ipath.path.end());
 		return new_path;
 	}
@@ -234,366 +436,4185 @@ public:
 	~Path(void) = default;
 };
 
-struct Grid {
-	using Entry = std::size_t;
+// Components of a path string, split in place without allocating
+struct PathComponents {
+	std::string_view path;
 
-	struct Table {
-		std::unordered_map<std::string, Table> nested;
-		std::unordered_map<std::string, Entry> contained;
+	struct iterator {
+		std::string_view path;
+		std::size_t start;
+		std::size_t end;
 
-		~Table(void) = default;
-	};
+		iterator(std::string_view ipath, std::size_t istart) : path(ipath), start(istart), end(istart) { next_(); }
 
-private:
+		std::string_view operator*(void) const { return path.substr(start, end - start); }
 
-	std::ifstream stream_;
-	std::size_t bunch_offset;
+		iterator& operator++(void) { start = end; next_(); return *this; }
 
-public:
-	Table table;
+		bool operator==(const iterator &iother) const { return start == iother.start; }
 
-public:
+	private:
 
-	bool find_parent_table(const Path &ipath, const Table* &otable) {
-		if(ipath.empty() || !otable)
-			return false;
+		// Skip separators and find the end of the next component
+		void next_(void) {
+			while(start < path.size() && path[start] == Path::SEPARATOR)
+				++start;
 
-		for(std::size_t i = 0; i < ipath.path.size() - 1; ++i) {
-			auto it = otable->nested.find(ipath.path[i]);
+			end = start;
 
-			if(it == otable->nested.end())
-				return false;
+			while(end < path.size() && path[end] != Path::SEPARATOR)
+				++end;
 
-			otable = &(it->second);
+			return;
 		}
+	};
 
-		return true;
-	}
+	iterator begin(void) const { return iterator(path, 0); }
+	iterator end(void) const { return iterator(path, path.size()); }
 
-	// Is directory in directory
-	bool is_directory(const Path &ipath, const Table &itable) {
-		if(ipath.empty())
-			return false;
+	bool empty(void) const { return begin() == end(); }
+};
 
-		// Searching for the directory by path
+// Anything that can be viewed as a path string
+template<typename T>
+concept PathString = std::convertible_to<const T&, std::string_view>;
 
-		const Table *actual = &itable;
-		if(!find_parent_table(ipath, actual))
-			return false;
+// Anything that can run a job somewhere else
+template<typename T>
+concept Executor = requires(T &iexecutor, std::function<void(void)> ijob) {
+	iexecutor.execute(std::move(ijob));
+};
 
-		return actual->nested.contains(ipath.path.back());
-	}
+// Small executor, runs jobs on a few threads in the order they come
+struct Pool {
+	void execute(std::function<void(void)> ijob) {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			jobs_.push_back(std::move(ijob));
+			++pending_;
+		}
 
-	// Is directory
-	bool is_directory(const Path &ipath) {
-		return is_directory(ipath, table);
+		wake_.notify_one();
+		return;
 	}
 
-	// Is regular file in directory
-	bool is_regular_file(const Path &ipath, const Table &itable) {
-		if(ipath.empty())
-			return false;
-
-		// Searching for the entry by path
+	// Wait until every job so far is done
+	void wait(void) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		idle_.wait(lock, [this](void) -> bool { return pending_ == 0; });
+		return;
+	}
 
-		const Table *actual = &itable;
-		if(!find_parent_table(ipath, actual))
-			return false;
+	// One thread per core, at least two, if ithreads is 0
+	Pool(unsigned ithreads = 0) {
+		if(ithreads == 0) {
+			ithreads = std::thread::hardware_concurrency();
 
-		return actual->contained.contains(ipath.path.back());;
-	}
+			if(ithreads < 2)
+				ithreads = 2;
+		}
 
-	// Is regular file
-	bool is_regular_file(const Path &ipath) {
-		return is_regular_file(ipath, table);
+		for(unsigned i = 0; i < ithreads; ++i)
+			workers_.emplace_back(&Pool::work_, this);
 	}
 
-	// Exists in directory
-	bool exists(const Path &ipath, const Table &itable) {
-		if(ipath.empty())
-			return false;
+	Pool(const Pool &) = delete;
+	Pool& operator=(const Pool &) = delete;
 
-		// Searching for the entry by path
+	// Runs every job that is left
+	~Pool(void) {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
 
-		const Table *actual = &itable;
-		if(!find_parent_table(ipath, actual))
-			return false;
+		wake_.notify_all();
 
-		return actual->nested.contains(ipath.path.back()) || actual->contained.contains(ipath.path.back());
+		for(std::thread &worker : workers_)
+			worker.join();
 	}
 
-	// Exists
-	bool exists(const Path &ipath) {
-		return exists(ipath, table);
-	}
+private:
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::condition_variable idle_;
+	std::deque<std::function<void(void)>> jobs_;
+	// Jobs that are not done yet
+	std::size_t pending_ = 0;
+	bool stopping_ = false;
 
-	// Find directory in directory
-	bool find_directory(const Path &ipath, Table &otable, const Table &itable) {
-		if(ipath.empty())
-			return false;
+	std::vector<std::thread> workers_;
 
-		// Searching for the directory by path
+	void work_(void) {
+		for(;;) {
+			std::function<void(void)> job;
 
-		const Table *actual = &itable;
-		if(!find_parent_table(ipath, actual))
-			return false;
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				wake_.wait(lock, [this](void) -> bool { return stopping_ || !jobs_.empty(); });
 
-		// Take a table from the directory
+				if(jobs_.empty())
+					return;
 
-		{
-			auto found = actual->nested.find(ipath.path.back());
+				job = std::move(jobs_.front());
+				jobs_.pop_front();
+			}
 
-			if(found == actual->nested.end())
-				return false;
+			job();
 
-			otable = found->second;
-		}
+			std::lock_guard<std::mutex> lock(mutex_);
 
-		return true;
+			if(--pending_ == 0)
+				idle_.notify_all();
+		}
 	}
+};
 
-	// Find directory
-	bool find_directory(const Path &ipath, Table &otable) {
-		return find_directory(ipath, otable, table);
-	}
+// CRC32C of isize bytes, can be continued by passing the previous
+// checksum.  Runs on the CRC instructions of the CPU where there are
+inline std::uint32_t crc32c(const void *idata, std::size_t isize, std::uint32_t icrc = 0) noexcept {
+	const std::uint8_t *data = static_cast<const std::uint8_t*>(idata);
 
-	// Find file in directory
-	std::size_t find_file(const Path &ipath, const Table &itable) {
-		if(ipath.empty())
-			return 0;
+#if GRID_CRC_X86
+	static const bool hardware = __builtin_cpu_supports("sse4.2");
 
-		std::size_t offset = 0;
+	if(hardware)
+		return ~crc_hardware(~icrc, data, isize);
+#elif GRID_CRC_ARM
+	return ~crc_hardware(~icrc, data, isize);
+#endif
 
-		// Searching for the entry by path
+	return ~crc_software(~icrc, data, isize);
+}
 
-		const Table *actual = &itable;
-		if(!find_parent_table(ipath, actual))
-			return false;
+// Layout of grid images, shared with the packer that writes them
+namespace format {
+
+// Entries of versioned images start with the stored size in 8 bytes,
+// legacy ones with a plain size in SIZE_SIZE bytes
+inline constexpr std::size_t ENTRY_SIZE_SIZE = 8;
+
+// Bit 63 of the entry size says that the entry is compressed,
+// a codec byte and the raw size in 8 bytes follow
+inline constexpr std::uint64_t ENTRY_COMPRESSED = (std::uint64_t)1 << 63;
+
+// Bit 62 says that a 4 byte CRC32C of the stored data follows,
+// it comes before the codec
+inline constexpr std::uint64_t ENTRY_CHECKSUM = (std::uint64_t)1 << 62;
+
+// Compressed entries are a chain of blocks, each one is a 4 byte
+// size and the block data, the top bit of the size says the
+// block is stored raw
+inline constexpr std::size_t COMPRESS_BLOCK_SIZE = 64 * 1024;
+inline constexpr std::uint32_t BLOCK_RAW = 0x80000000u;
+
+// Path index trailer is the index offset and this magic
+inline constexpr char INDEX_MAGIC[8] = { 'G', 'R', 'I', 'D', 'H', 'A', 'S', 'H' };
+inline constexpr std::size_t INDEX_TRAILER_SIZE = 16;
+inline constexpr std::size_t INDEX_SLOT_SIZE = 32;
+
+// Images from version 2 on start with the magic, a 2 byte version,
+// 2 bytes of flags and the size of all tables in 8 bytes.  Older
+// images start with the tables size in SIZE_SIZE bytes
+inline constexpr char IMAGE_MAGIC[4] = { 'G', 'R', 'I', 'D' };
+inline constexpr std::size_t IMAGE_HEADER_SIZE = 16;
+// Version 2 tables kept every name in full and are not read any
+// more, version 3 ones front code them
+inline constexpr std::uint16_t IMAGE_VERSION = 3;
+// Tables hold the raw size of every file
+inline constexpr std::uint16_t IMAGE_FILE_SIZES = 2;
+// Tables hold the last write time of every file
+inline constexpr std::uint16_t IMAGE_FILE_TIMES = 4;
+// Flags this reader knows, an image with any other one is refused
+inline constexpr std::uint16_t IMAGE_FLAGS = IMAGE_FILE_SIZES | IMAGE_FILE_TIMES;
+
+// A version 3 table is the number of directories, the number of
+// files and the size of the names, 4 bytes each, then the target
+// of every directory and every file in 8 bytes each, both sorted
+// by name, then the offset of every restart in the names in 4
+// bytes each, directories first, then the front coded names.
+// Every name but each NAME_RESTART_INTERVAL-th one only keeps
+// what differs from the name before it
+inline constexpr std::size_t TABLE_HEAD_SIZE = 12;
+inline constexpr std::size_t NAME_RESTART_INTERVAL = 16;
+inline constexpr std::size_t TABLE_TARGET_SIZE = 8;
+
+// Sizes and times of files, 8 bytes each, go right after the
+// targets, in the order of the files
+inline constexpr std::size_t TABLE_STAT_SIZE = 8;
+
+// Paths in the index are hashed with FNV-1a from this seed, with
+// a hash_name("/") between their components
+inline constexpr std::uint64_t HASH_SEED = 0xcbf29ce484222325ull;
+
+// FNV-1a, can be continued by passing the previous hash as a seed
+inline std::uint64_t hash_name(std::string_view iname, std::uint64_t iseed = HASH_SEED) noexcept {
+	std::uint64_t hash = iseed;
+
+	for(char c : iname) {
+		hash ^= (std::uint8_t)c;
+		hash *= 0x100000001b3ull;
+	}
 
-		// Take an offset from the entry
+	return hash;
+}
 
-		{
-			auto found = actual->contained.find(ipath.path.back());
+}
 
-			if(found == actual->contained.end())
-				return 0;
+// Grid image reader
+//
+// Once constructed, every reading method is const and can be
+// called from many threads at once: entries are read with
+// positional reads (or straight from the mapping), so there is
+// no shared file position to fight over.
+struct Grid {
+	using Entry = std::size_t;
 
-			offset = found->second;
+	// Directory index
+	//
+	// Names of all nodes live one after another in a single
+	// string, nodes are kept in flat arrays sorted by name, and a
+	// small open addressing index over each array turns a lookup
+	// into a single probe.
+	struct Table {
+		struct Node {
+			std::uint32_t name_offset;
+			std::uint32_t name_size;
+			// File payload offset or directory table offset
+			Entry target;
+		};
+
+		// Filled in on first use when the grid is opened LAZY
+		mutable std::string names;
+		mutable std::vector<Node> directories;
+		mutable std::vector<Node> files;
+		// Table of every directory, in the same order
+		mutable std::vector<Table> tables;
+		// Node index + 1 by name hash, 0 for an empty slot
+		mutable std::vector<std::uint32_t> directory_slots;
+		mutable std::vector<std::uint32_t> file_slots;
+		// Raw size and last write time of every file, in the same
+		// order, empty if the image has none
+		mutable std::vector<std::uint64_t> sizes;
+		mutable std::vector<std::int64_t> times;
+
+		std::string_view name(const Node &inode) const {
+			return std::string_view(names.data() + inode.name_offset, inode.name_size);
 		}
 
-		return offset;
-	}
+		// Find directory node by name, nullptr if there is none
+		const Node* find_directory(std::string_view iname) const {
+			return find_(directories, directory_slots, iname);
+		}
 
-	// Find file
-	std::size_t find_file(const Path &ipath) {
-		return find_file(ipath, table);
-	}
+		// Find file node by name, nullptr if there is none
+		const Node* find_file(std::string_view iname) const {
+			return find_(files, file_slots, iname);
+		}
 
-	// Get file content
-	bool get_file_content(std::size_t ioffset, std::vector<char> &odata) {
-		std::size_t entry_size = 0;
+		// Find directory table by name, nullptr if there is none
+		const Table* find_table(std::string_view iname) const {
+			const Node *node = find_(directories, directory_slots, iname);
+			if(!node)
+				return nullptr;
 
-		stream_.seekg(ioffset, std::ios::beg);
+			return &tables[node - directories.data()];
+		}
 
-		// Read entry size
+	private:
+		friend struct Grid;
 
-		{
-			std::uint8_t entry_size_bytes[SIZE_SIZE];
-			stream_.read((char*)entry_size_bytes, SIZE_SIZE);
+		enum : std::uint8_t {
+			LOADED,
+			PENDING,
+			LOADING,
+			BROKEN,
+		};
 
-			if(stream_.gcount() != SIZE_SIZE)
-				return false;
+		mutable std::atomic<std::uint8_t> state_ = LOADED;
+		// Where the table is in the image while it is pending
+		std::size_t offset_ = 0;
 
-			for(std::size_t i = 0; i < SIZE_SIZE; ++i) {
-				entry_size |= ((size_t)entry_size_bytes[i]) << (8 * i);
+		const Node* find_(const std::vector<Node> &inodes, const std::vector<std::uint32_t> &islots, std::string_view iname) const {
+			if(islots.empty())
+				return nullptr;
+
+			std::size_t mask = islots.size() - 1;
+
+			for(std::size_t i = format::hash_name(iname) & mask; islots[i]; i = (i + 1) & mask) {
+				const Node &node = inodes[islots[i] - 1];
+
+				if(name(node) == iname)
+					return &node;
 			}
-		}
 
-		// Write out entry content by chunks
+			return nullptr;
+		}
 
-		{
-			constexpr std::size_t BUFFSZ = 4096;
-			std::size_t rest = entry_size;
+		// Sort nodes by name and index them, keeps the slots at most half full
+		void index_(std::vector<Node> &unodes, std::vector<std::uint32_t> &oslots) const {
+			std::sort(unodes.begin(), unodes.end(),
+				[this](const Node &ia, const Node &ib) -> bool { return name(ia) < name(ib); });
 
-			odata.resize(entry_size);
+			oslots.clear();
+			if(unodes.empty())
+				return;
 
-			std::size_t offset = 0;
+			std::size_t slots = 2;
+			while(slots < unodes.size() * 2)
+				slots *= 2;
 
-			while(rest >= 1) {
-				std::size_t to_read = rest < BUFFSZ ? rest : BUFFSZ;
+			oslots.assign(slots, 0);
+			std::size_t mask = slots - 1;
 
-				stream_.read((char*)odata.data() + offset, to_read);
+			for(std::size_t n = 0; n < unodes.size(); ++n) {
+				std::size_t i = format::hash_name(name(unodes[n])) & mask;
 
-				if(stream_.gcount() != static_cast<std::streamsize>(to_read))
-					return false;
+				while(oslots[i])
+					i = (i + 1) & mask;
 
-				offset += to_read;
-				rest   -= to_read;
+				oslots[i] = (std::uint32_t)(n + 1);
 			}
-		}
 
-		return true;
-	}
+			return;
+		}
 
-	// Read file in directory
-	bool read(const Path &ipath, std::vector<char> &odata, const Table &itable) {
-		if(ipath.empty())
-			return false;
+		// Tables that are not read in yet are copied as pending,
+		// someone else may be filling them in right now
+		void assign_(const Table &itable, bool imove) {
+			std::uint8_t state = itable.state_.load(std::memory_order_acquire);
+
+			names.clear();
+			directories.clear();
+			files.clear();
+			tables.clear();
+			directory_slots.clear();
+			file_slots.clear();
+			sizes.clear();
+			times.clear();
+			offset_ = itable.offset_;
+
+			if(state != LOADED) {
+				state_.store(state == BROKEN ? BROKEN : PENDING, std::memory_order_relaxed);
+				return;
+			}
 
-		std::size_t offset = find_file(ipath, itable);
-		if(!offset)
-			return false;
+			if(imove) {
+				names = std::move(itable.names);
+				directories = std::move(itable.directories);
+				files = std::move(itable.files);
+				tables = std::move(itable.tables);
+				directory_slots = std::move(itable.directory_slots);
+				file_slots = std::move(itable.file_slots);
+				sizes = std::move(itable.sizes);
+				times = std::move(itable.times);
+			} else {
+				names = itable.names;
+				directories = itable.directories;
+				files = itable.files;
+				tables = itable.tables;
+				directory_slots = itable.directory_slots;
+				file_slots = itable.file_slots;
+				sizes = itable.sizes;
+				times = itable.times;
+			}
 
-		return get_file_content(offset, odata);
-	}
+			state_.store(LOADED, std::memory_order_relaxed);
+			return;
+		}
 
-	// Read file
-	bool read(const Path &ipath, std::vector<char> &odata) {
-		return read(ipath, odata, table);
-	}
+	public:
 
-private:
+		Table(void) = default;
 
-	// Read file in table
-	bool read_in_table_(Table& otable) {
-		std::size_t table_size = 0;
+		Table(const Table &itable) { assign_(itable, false); }
+		Table(Table &&itable) noexcept { assign_(itable, true); }
 
-		// Read table size
+		Table& operator=(const Table &itable) {
+			if(this != &itable)
+				assign_(itable, false);
+			return *this;
+		}
 
-		{
-			std::uint8_t table_size_bytes[SIZE_SIZE];
-			stream_.read((char*)table_size_bytes, SIZE_SIZE);
+		Table& operator=(Table &&itable) noexcept {
+			if(this != &itable)
+				assign_(itable, true);
+			return *this;
+		}
 
-			if(stream_.gcount() != SIZE_SIZE)
-				return false;
+		~Table(void) = default;
+	};
 
-			for(std::size_t i = 0; i < SIZE_SIZE; ++i) {
-				table_size |= ((size_t)table_size_bytes[i]) << (8 * i);
-			}
-		}
+	// What stat() tells about a path
+	struct Stat {
+		// 'd' or 'f'
+		char type;
+		// File payload offset or directory table offset
+		Entry target;
+		// Raw size of a file, what a read gives, 0 for directories
+		std::uint64_t size;
+		// Last write time of a file in nanoseconds since the Unix
+		// epoch, 0 if the image has none
+		std::int64_t mtime;
+	};
 
-		for(std::size_t i = 0; i < table_size; ++i) {
-			bool is_directory;
+	// Node of a directory as an iteration yields it.  Names and
+	// paths are views into the grid and the iterator, good until
+	// the iterator moves on
+	struct DirectoryEntry {
+		std::string_view name;
+		// Path from the directory iterated over, just the name
+		// unless walking into nested directories
+		std::string_view path;
+		// 'd' or 'f'
+		char type;
+		// File payload offset or directory table offset
+		Entry target;
+		// Raw size of a file, 0 for directories and when the image
+		// has no sizes, see has_sizes()
+		std::uint64_t size;
+		// Directories down from the one iterated over
+		std::size_t depth;
+
+		bool is_directory(void) const noexcept { return type == 'd'; }
+		bool is_regular_file(void) const noexcept { return type == 'f'; }
+	};
 
-			// Read node type
+	// Directory borrowed from the grid, nothing is copied.
+	// Directories come first, then files, both sorted by name
+	struct Directory {
+		struct iterator {
+			DirectoryEntry operator*(void) const {
+				std::size_t directories = table_->directories.size();
+				bool directory = index_ < directories;
 
-			{
-				std::uint8_t c;
+				const Table::Node &node = directory ? table_->directories[index_] : table_->files[index_ - directories];
+				std::string_view name = table_->name(node);
 
-				stream_.read((char*)&c, 1);
-				if(stream_.gcount() != 1)
-					return false;
+				std::uint64_t size = directory || table_->sizes.empty() ? 0 : table_->sizes[index_ - directories];
 
-				is_directory = (char)c == 'd';
+				return { name, name, directory ? 'd' : 'f', node.target, size, 0 };
 			}
 
-			std::string name = "";
+			iterator& operator++(void) { ++index_; return *this; }
 
-			// Read node name
+			bool operator==(const iterator &iother) const { return index_ == iother.index_; }
 
-			{
-				std::uint8_t read[64];
-				bool end = false;
+		private:
+			friend struct Directory;
 
-				while(!end) {
-					stream_.read((char*)read, sizeof(read));
-					std::streamsize rest = stream_.gcount();
+			iterator(const Table *itable, std::size_t iindex) : table_(itable), index_(iindex) {}
 
-					for(std::streamsize i = 0; i < rest; ++i) {
-						if((char)read[i] != '\0')
-							continue;
+			const Table *table_;
+			std::size_t index_;
+		};
 
-						name.append((char*)read, i);
-						stream_.seekg(i - rest + 1, std::ios::cur);
-						end = true;
-						break;
-					}
+		iterator begin(void) const { return iterator(table_, 0); }
+		iterator end(void) const { return iterator(table_, size()); }
 
-					if(!end)
-						name.append((char*)read, rest);
-				}
-			}
+		std::size_t size(void) const noexcept { return table_ ? table_->directories.size() + table_->files.size() : 0; }
+		bool empty(void) const noexcept { return size() == 0; }
 
-			std::size_t pointing = 0;
+		Directory(void) = default;
 
-			// Read node pointer
+	private:
+		friend struct Grid;
 
-			{
-				std::uint8_t offset_bytes[SIZE_SIZE];
-				stream_.read((char*)offset_bytes, SIZE_SIZE);
+		explicit Directory(const Table *itable) : table_(itable) {}
 
-				if(stream_.gcount() != SIZE_SIZE)
-					return false;
+		const Table *table_ = nullptr;
+	};
 
-				for(std::size_t i = 0; i < SIZE_SIZE; ++i) {
-					pointing |= ((size_t)offset_bytes[i]) << (8 * i);
-				}
+	// Walk through a directory and every nested one, depth first,
+	// every directory right before its content, the way
+	// std::filesystem::recursive_directory_iterator goes.  Tables
+	// of LAZY grids are read in on the way, a directory that cannot
+	// be read is still yielded, but not walked into, and counted in
+	// failed().  Iterators keep a stack and the path, both only
+	// grow as deep and as long as the tree goes
+	struct Walk {
+		struct iterator {
+			DirectoryEntry operator*(void) const {
+				DirectoryEntry entry = entry_;
+				entry.path = path_;
+				return entry;
 			}
 
-			// Add a node to the table
+			iterator& operator++(void) { advance_(); return *this; }
 
-			if(is_directory) {
-				// If this node is a table too, call this method
-				Table nested_table;
+			bool operator==(std::default_sentinel_t) const { return stack_.empty(); }
 
-				std::size_t was_here = stream_.tellg();
+		private:
+			friend struct Walk;
 
-				stream_.seekg(pointing, std::ios::beg);
-				read_in_table_(nested_table);
+			struct Frame {
+				const Table *table;
+				std::size_t index;
+				// Path of the table, its nodes go after it
+				std::size_t path_size;
+			};
 
-				otable.nested.emplace(name, nested_table);
-				stream_.seekg(was_here, std::ios::beg);
-			} else {
-				otable.contained.emplace(name, pointing);
-			}
-		}
+			Walk *walk_ = nullptr;
+			std::vector<Frame> stack_;
+			std::string path_;
+			DirectoryEntry entry_ = {};
 
-		return true;
-	}
+			// Take the next node, finished tables are left
+			void settle_(void) {
+				while(!stack_.empty()) {
+					const Frame &frame = stack_.back();
+					std::size_t directories = frame.table->directories.size();
 
-public:
+					if(frame.index < directories + frame.table->files.size()) {
+						bool directory = frame.index < directories;
 
-	Grid(const std::filesystem::path &ipath) {
-		stream_.open(ipath, std::ios::binary);
+						const Table::Node &node = directory ? frame.table->directories[frame.index] : frame.table->files[frame.index - directories];
+						std::string_view name = frame.table->name(node);
 
-		if(!stream_.is_open())
-			throw std::ios_base::failure("Unable to open file for reading");
+						path_.resize(frame.path_size);
+						if(frame.path_size)
+							path_ += Path::SEPARATOR;
+						path_ += name;
 
-		{
-			std::size_t table_size = 0;
+						std::size_t file = frame.index - directories;
+						std::uint64_t size = directory || frame.table->sizes.empty() ? 0 : frame.table->sizes[file];
 
-			// Read all tables size
+						entry_ = { name, {}, directory ? 'd' : 'f', node.target, size, stack_.size() - 1 };
+						return;
+					}
 
-			{
-				stream_.seekg(0, std::ios::end);
-				std::size_t file_size = stream_.tellg();
-				stream_.seekg(0, std::ios::beg);
+					stack_.pop_back();
+				}
 
-				if(file_size < SIZE_SIZE)
-					throw std::runtime_error("File corrupted");
+				return;
+			}
 
-				std::uint8_t table_size_bytes[SIZE_SIZE];
-				stream_.read((char*)table_size_bytes, SIZE_SIZE);
+			// Go into the directory just yielded, or past the file
+			void advance_(void) {
+				Frame &frame = stack_.back();
+				std::size_t at = frame.index++;
 
-				if(stream_.gcount() != SIZE_SIZE)
-					throw std::ios_base::failure("Unable to read file");
+				if(at < frame.table->directories.size()) {
+					const Table &nested = frame.table->tables[at];
 
-				for(std::uint8_t i = 0; i < SIZE_SIZE; ++i) {
-					table_size |= ((size_t)table_size_bytes[i]) << (8 * i);
+					if(walk_->grid_->load(nested))
+						stack_.push_back({ &nested, 0, path_.size() });
+					else
+						++walk_->failed_;
 				}
 
-				if(file_size < table_size)
-					throw std::runtime_error("File corrupted");
+				settle_();
+				return;
 			}
+		};
 
-			bunch_offset = SIZE_SIZE + table_size;
+		iterator begin(void) {
+			iterator it;
+			it.walk_ = this;
 
-			if(!read_in_table_(table))
-				throw std::runtime_error("Grid corrupted");
+			if(table_)
+				it.stack_.push_back({ table_, 0, 0 });
+
+			it.settle_();
+			return it;
 		}
-	}
 
-	~Grid(void) = default;
+		std::default_sentinel_t end(void) const { return {}; }
+
+		// Directories that could not be read
+		std::size_t failed(void) const noexcept { return failed_; }
+
+	private:
+		friend struct Grid;
+
+		Walk(const Grid *igrid, const Table *itable) : grid_(igrid), table_(itable) {}
+
+		const Grid *grid_;
+		const Table *table_;
+		std::size_t failed_ = 0;
+	};
+
+	enum class Codec : std::uint8_t {
+		NONE = 0,
+		// LZ4 block format, in independent blocks of COMPRESS_BLOCK_SIZE raw bytes
+		LZ4 = 1,
+	};
+
+	enum class Mode : std::uint8_t {
+		// Read entries from the file at their offsets
+		STREAM,
+		// Map the whole image into memory, falls back to STREAM
+		// if the image cannot be mapped
+		MAP,
+	};
+
+	enum class Load : std::uint8_t {
+		// Read every table in the constructor
+		EAGER,
+		// Read only the root table in the constructor, nested
+		// tables are read the first time a path goes through them
+		LAZY,
+	};
+
+	enum class Check : std::uint8_t {
+		// Trust entry data
+		NONE,
+		// Reading a whole entry that has a checksum fails if the
+		// data does not match it, Readers do not check
+		READS,
+	};
+
+	// Entry header, an entry takes the image bytes from its
+	// offset up to data + stored
+	struct Header {
+		// Size of the data in the image
+		std::size_t stored;
+		// Size of the data once decoded
+		std::size_t raw;
+		// Offset of the data in the image
+		std::size_t data;
+		Codec codec;
+		// CRC32C of the stored data, if the entry has one
+		bool checksummed;
+		std::uint32_t checksum;
+	};
+
+private:
+
+	// Read-only view of the whole image in memory
+	struct Mapping {
+		const std::byte *data = nullptr;
+		std::size_t size = 0;
+
+		bool open(const std::filesystem::path &ipath) {
+			close();
+
+#if GRID_POSIX
+			int fd = ::open(ipath.c_str(), O_RDONLY);
+			if(fd < 0)
+				return false;
+
+			struct stat st;
+			if(::fstat(fd, &st) != 0 || st.st_size <= 0) {
+				::close(fd);
+				return false;
+			}
+
+			void *addr = ::mmap(nullptr, (std::size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			// The mapping keeps its own reference to the file
+			::close(fd);
+
+			if(addr == MAP_FAILED)
+				return false;
+
+			data = static_cast<const std::byte*>(addr);
+			size = (std::size_t)st.st_size;
+			return true;
+#else
+			(void)ipath;
+			return false;
+#endif
+		}
+
+		void close(void) noexcept {
+#if GRID_POSIX
+			if(data)
+				::munmap(const_cast<std::byte*>(data), size);
+#endif
+			data = nullptr;
+			size = 0;
+			return;
+		}
+
+		Mapping(void) = default;
+
+		Mapping(const Mapping &) = delete;
+		Mapping& operator=(const Mapping &) = delete;
+
+		Mapping(Mapping &&imapping) noexcept : data(imapping.data), size(imapping.size) {
+			imapping.data = nullptr;
+			imapping.size = 0;
+		}
+
+		Mapping& operator=(Mapping &&imapping) noexcept {
+			if(this == &imapping)
+				return *this;
+
+			close();
+			data = imapping.data;
+			size = imapping.size;
+			imapping.data = nullptr;
+			imapping.size = 0;
+			return *this;
+		}
+
+		~Mapping(void) { close(); }
+	};
+
+	// Image file that can be read at any offset by many threads at once
+	struct File {
+#if GRID_POSIX
+		int fd = -1;
+#else
+		// No positional reads here, so a single stream is shared under a lock
+		struct Stream {
+			std::mutex mutex;
+			std::ifstream stream;
+		};
+
+		std::unique_ptr<Stream> stream;
+#endif
+		std::size_t size = 0;
+
+		bool open(const std::filesystem::path &ipath) {
+			close();
+
+#if GRID_POSIX
+			fd = ::open(ipath.c_str(), O_RDONLY);
+			if(fd < 0)
+				return false;
+
+			struct stat st;
+			if(::fstat(fd, &st) != 0) {
+				close();
+				return false;
+			}
+
+			size = (std::size_t)st.st_size;
+#else
+			stream = std::make_unique<Stream>();
+			stream->stream.open(ipath, std::ios::binary);
+
+			if(!stream->stream.is_open()) {
+				close();
+				return false;
+			}
+
+			stream->stream.seekg(0, std::ios::end);
+			size = (std::size_t)stream->stream.tellg();
+			stream->stream.seekg(0, std::ios::beg);
+#endif
+			return true;
+		}
+
+		// Read up to isize bytes at ioffset, returns how many were read
+		std::size_t read_at(std::size_t ioffset, void *odata, std::size_t isize) const {
+			std::size_t done = 0;
+
+#if GRID_POSIX
+			while(done < isize) {
+				ssize_t got = ::pread(fd, (char*)odata + done, isize - done, (off_t)(ioffset + done));
+
+				if(got < 0 && errno == EINTR)
+					continue;
+				if(got <= 0)
+					break;
+
+				done += (std::size_t)got;
+			}
+#else
+			std::lock_guard<std::mutex> lock(stream->mutex);
+
+			stream->stream.clear();
+			stream->stream.seekg(ioffset, std::ios::beg);
+			stream->stream.read((char*)odata, isize);
+			done = (std::size_t)stream->stream.gcount();
+#endif
+			return done;
+		}
+
+		void close(void) noexcept {
+#if GRID_POSIX
+			if(fd >= 0)
+				::close(fd);
+			fd = -1;
+#else
+			stream.reset();
+#endif
+			size = 0;
+			return;
+		}
+
+		File(void) = default;
+
+		File(const File &) = delete;
+		File& operator=(const File &) = delete;
+
+#if GRID_POSIX
+		File(File &&ifile) noexcept : fd(ifile.fd), size(ifile.size) {
+			ifile.fd = -1;
+			ifile.size = 0;
+		}
+
+		File& operator=(File &&ifile) noexcept {
+			if(this == &ifile)
+				return *this;
+
+			close();
+			fd = ifile.fd;
+			size = ifile.size;
+			ifile.fd = -1;
+			ifile.size = 0;
+			return *this;
+		}
+#else
+		File(File &&) noexcept = default;
+		File& operator=(File &&) noexcept = default;
+#endif
+
+		~File(void) { close(); }
+	};
+
+	File file_;
+	std::size_t bunch_offset;
+	// Where the root table starts
+	std::size_t tables_offset_ = SIZE_SIZE;
+	std::uint16_t version_ = 1;
+	bool sizes_ = false;
+	bool times_ = false;
+	Mapping mapping_;
+	bool lazy_ = false;
+	Check check_ = Check::NONE;
+
+	// Full path index, points into the mapping or index_data_.
+	// LAZY stream grids leave it empty and probe the index right
+	// in the file, so opening does not read all of it
+	std::span<const std::byte> index_;
+	std::vector<std::byte> index_data_;
+	std::size_t index_offset_ = 0;
+	std::size_t index_size_ = 0;
+	std::size_t index_slots_ = 0;
+
+	// Paths up to this long are compared on the stack when the
+	// index is probed in the file
+	static constexpr std::size_t INDEX_PATH_BUFFER_SIZE = 4096;
+
+	static std::uint32_t load_u32_(const void *ibytes) noexcept {
+		const std::uint8_t *bytes = static_cast<const std::uint8_t*>(ibytes);
+
+		return (std::uint32_t)bytes[0] | (std::uint32_t)bytes[1] << 8
+			| (std::uint32_t)bytes[2] << 16 | (std::uint32_t)bytes[3] << 24;
+	}
+
+	static std::uint64_t load_u64_(const void *ibytes) noexcept {
+		const std::uint8_t *bytes = static_cast<const std::uint8_t*>(ibytes);
+		std::uint64_t value = 0;
+
+		for(std::size_t i = 0; i < 8; ++i) {
+			value |= ((std::uint64_t)bytes[i]) << (8 * i);
+		}
+
+		return value;
+	}
+
+	// Read from the mapping if there is one, from the file otherwise
+	std::size_t read_at_(std::size_t ioffset, void *odata, std::size_t isize) const {
+		// Empty tables read nothing, odata may be null then
+		if(isize == 0)
+			return 0;
+
+		if(!is_mapped())
+			return file_.read_at(ioffset, odata, isize);
+
+		if(ioffset >= mapping_.size)
+			return 0;
+
+		std::size_t available = mapping_.size - ioffset < isize ? mapping_.size - ioffset : isize;
+		std::memcpy(odata, mapping_.data + ioffset, available);
+		return available;
+	}
+
+	// Longest entry header: size, checksum, codec and raw size
+	static constexpr std::size_t HEADER_SIZE_MAX = format::ENTRY_SIZE_SIZE + 4 + 1 + 8;
+
+	// Parse an entry header out of the isize bytes at ioffset
+	bool parse_header_(std::size_t ioffset, const std::uint8_t *ibytes, std::size_t isize, Header &oheader) const {
+		std::size_t size_size = version_ >= 2 ? format::ENTRY_SIZE_SIZE : SIZE_SIZE;
+
+		if(isize < size_size)
+			return false;
+
+		std::uint64_t entry_size = 0;
+
+		for(std::size_t i = 0; i < size_size; ++i) {
+			entry_size |= ((std::uint64_t)ibytes[i]) << (8 * i);
+		}
+
+		// Legacy entries have no flags
+		std::uint64_t flags = version_ >= 2 ? entry_size & (format::ENTRY_COMPRESSED | format::ENTRY_CHECKSUM) : 0;
+		std::uint64_t stored = entry_size & ~flags;
+
+		if(stored > SIZE_MAX)
+			return false;
+
+		oheader.stored = (std::size_t)stored;
+		oheader.raw = oheader.stored;
+		oheader.data = ioffset + size_size;
+		oheader.codec = Codec::NONE;
+		oheader.checksummed = false;
+		oheader.checksum = 0;
+
+		std::size_t at = size_size;
+
+		// Checksum
+
+		if(flags & format::ENTRY_CHECKSUM) {
+			if(isize < at + 4)
+				return false;
+
+			oheader.checksummed = true;
+			oheader.checksum = (std::uint32_t)ibytes[at] | (std::uint32_t)ibytes[at + 1] << 8
+				| (std::uint32_t)ibytes[at + 2] << 16 | (std::uint32_t)ibytes[at + 3] << 24;
+
+			at += 4;
+			oheader.data = ioffset + at;
+		}
+
+		// Codec and raw size
+
+		if(flags & format::ENTRY_COMPRESSED) {
+			if(isize < at + 1 + 8)
+				return false;
+
+			if(ibytes[at] != (std::uint8_t)Codec::LZ4)
+				return false;
+
+			oheader.codec = (Codec)ibytes[at];
+			oheader.raw = load_u64_(ibytes + at + 1);
+			oheader.data = ioffset + at + 1 + 8;
+
+			// Nothing expands more than 255 times
+			if(oheader.raw / 255 > oheader.stored)
+				return false;
+		}
+
+		std::size_t size = is_mapped() ? mapping_.size : file_.size;
+
+		if(oheader.data > size || size - oheader.data < oheader.stored)
+			return false;
+
+		return true;
+	}
+
+	// Read an entry header, the longest one is read at once,
+	// it is cut short only at the end of the image
+	bool read_header_(std::size_t ioffset, Header &oheader) const {
+		std::uint8_t header_bytes[HEADER_SIZE_MAX];
+
+		std::size_t got = read_at_(ioffset, header_bytes, HEADER_SIZE_MAX);
+
+		return parse_header_(ioffset, header_bytes, got, oheader);
+	}
+
+	// Decode one LZ4 block, it has to fill the output exactly
+	static bool decode_lz4_block_(const std::uint8_t *isrc, std::size_t isize, std::uint8_t *odst, std::size_t ocapacity) {
+		const std::uint8_t *in = isrc;
+		const std::uint8_t *in_end = isrc + isize;
+		std::uint8_t *out = odst;
+		std::uint8_t *out_end = odst + ocapacity;
+
+		while(in < in_end) {
+			std::uint8_t token = *in++;
+
+			// Copy literals
+
+			std::size_t literals = token >> 4;
+
+			if(literals == 15) {
+				std::uint8_t more;
+
+				do {
+					if(in >= in_end)
+						return false;
+
+					more = *in++;
+					literals += more;
+				} while(more == 255);
+			}
+
+			if((std::size_t)(in_end - in) < literals || (std::size_t)(out_end - out) < literals)
+				return false;
+
+			std::memcpy(out, in, literals);
+			in += literals;
+			out += literals;
+
+			// Last sequence has no match
+
+			if(in == in_end)
+				break;
+
+			// Copy match
+
+			if(in_end - in < 2)
+				return false;
+
+			std::size_t offset = in[0] | ((std::size_t)in[1] << 8);
+			in += 2;
+
+			if(offset == 0 || offset > (std::size_t)(out - odst))
+				return false;
+
+			std::size_t match = token & 15;
+
+			if(match == 15) {
+				std::uint8_t more;
+
+				do {
+					if(in >= in_end)
+						return false;
+
+					more = *in++;
+					match += more;
+				} while(more == 255);
+			}
+
+			match += 4;
+
+			if((std::size_t)(out_end - out) < match)
+				return false;
+
+			const std::uint8_t *from = out - offset;
+
+			if(offset >= match) {
+				std::memcpy(out, from, match);
+				out += match;
+			} else {
+				// Overlapping match repeats the last offset bytes
+				for(std::size_t i = 0; i < match; ++i)
+					*out++ = from[i];
+			}
+		}
+
+		return out == out_end;
+	}
+
+	// Decode stored entry data, it has to fill the output exactly
+	static bool decode_(Codec icodec, std::span<const std::byte> istored, std::span<std::byte> oraw) {
+		if(icodec == Codec::NONE) {
+			if(istored.size() != oraw.size())
+				return false;
+
+			if(!oraw.empty())
+				std::memcpy(oraw.data(), istored.data(), oraw.size());
+
+			return true;
+		}
+
+		const std::uint8_t *in = (const std::uint8_t*)istored.data();
+		std::size_t in_rest = istored.size();
+		std::uint8_t *out = (std::uint8_t*)oraw.data();
+		std::size_t out_rest = oraw.size();
+
+		while(out_rest > 0) {
+			if(in_rest < 4)
+				return false;
+
+			std::uint32_t block = (std::uint32_t)in[0] | ((std::uint32_t)in[1] << 8) | ((std::uint32_t)in[2] << 16) | ((std::uint32_t)in[3] << 24);
+			std::size_t block_size = block & ~format::BLOCK_RAW;
+			std::size_t block_raw = out_rest < format::COMPRESS_BLOCK_SIZE ? out_rest : format::COMPRESS_BLOCK_SIZE;
+
+			in += 4;
+			in_rest -= 4;
+
+			if(in_rest < block_size)
+				return false;
+
+			if(block & format::BLOCK_RAW) {
+				if(block_size != block_raw)
+					return false;
+
+				std::memcpy(out, in, block_raw);
+			} else if(!decode_lz4_block_(in, block_size, out, block_raw)) {
+				return false;
+			}
+
+			in += block_size;
+			in_rest -= block_size;
+			out += block_raw;
+			out_rest -= block_raw;
+		}
+
+		return in_rest == 0;
+	}
+
+	// Look a path up in the path index, by its components
+	template<typename Components>
+	bool probe_index_(const Components &icomponents, char &otype, Entry &otarget) const {
+		std::uint64_t hash = format::HASH_SEED;
+		bool first = true;
+
+		for(const auto &component : icomponents) {
+			if(!first)
+				hash = format::hash_name("/", hash);
+
+			hash = format::hash_name(component, hash);
+			first = false;
+		}
+
+		if(first || !index_slots_)
+			return false;
+
+		bool in_memory = !index_.empty();
+		std::size_t paths_offset = 8 + index_slots_ * format::INDEX_SLOT_SIZE;
+		std::size_t paths_size = index_size_ - paths_offset;
+
+		std::size_t mask = index_slots_ - 1;
+		std::size_t i = hash & mask;
+
+		for(std::size_t probes = 0; probes < index_slots_; ++probes, i = (i + 1) & mask) {
+			std::byte slot_bytes[format::INDEX_SLOT_SIZE];
+			const std::byte *slot = slot_bytes;
+
+			if(in_memory)
+				slot = index_.data() + 8 + i * format::INDEX_SLOT_SIZE;
+			else if(file_.read_at(index_offset_ + 8 + i * format::INDEX_SLOT_SIZE, slot_bytes, format::INDEX_SLOT_SIZE) != format::INDEX_SLOT_SIZE)
+				return false;
+
+			char type = (char)slot[28];
+
+			if(type == 0)
+				return false;
+
+			if(load_u64_(slot) != hash)
+				continue;
+
+			// Compare the stored path with the components
+
+			std::uint64_t path_offset = load_u64_(slot + 16);
+			std::uint32_t path_size = (std::uint32_t)(load_u64_(slot + 24) & 0xFFFFFFFF);
+
+			if(path_offset > paths_size || paths_size - path_offset < path_size)
+				return false;
+
+			std::string_view stored;
+			char path_bytes[INDEX_PATH_BUFFER_SIZE];
+			std::string long_path;
+
+			if(in_memory) {
+				stored = std::string_view((const char*)index_.data() + paths_offset + path_offset, path_size);
+			} else {
+				char *path = path_bytes;
+
+				if(path_size > sizeof(path_bytes)) {
+					long_path.resize(path_size);
+					path = long_path.data();
+				}
+
+				if(file_.read_at(index_offset_ + paths_offset + path_offset, path, path_size) != path_size)
+					return false;
+
+				stored = std::string_view(path, path_size);
+			}
+			std::size_t at = 0;
+			bool same = true;
+
+			first = true;
+
+			for(const auto &component : icomponents) {
+				if(!first) {
+					if(at >= stored.size() || stored[at] != Path::SEPARATOR) {
+						same = false;
+						break;
+					}
+
+					++at;
+				}
+
+				if(stored.substr(at, component.size()) != component) {
+					same = false;
+					break;
+				}
+
+				at += component.size();
+				first = false;
+			}
+
+			if(!same || at != stored.size())
+				continue;
+
+			otype = type;
+			otarget = load_u64_(slot + 8);
+			return true;
+		}
+
+		return false;
+	}
+
+public:
+
+	// Reads one entry piece by piece, a compressed entry is decoded
+	// one block at a time, so memory use does not grow with the
+	// entry.  It is a std::streambuf too, so it can back an
+	// std::istream.  Must not outlive the grid it was opened from
+	struct Reader : std::streambuf {
+		// Read up to isize bytes, returns how many were read
+		std::size_t read(void *odata, std::size_t isize) {
+			return (std::size_t)xsgetn((char*)odata, (std::streamsize)isize);
+		}
+
+		// Move to iposition in the entry, the end is a valid position
+		bool seek(std::size_t iposition) {
+			if(!grid_ || failed_ || iposition > header_.raw)
+				return false;
+
+			std::size_t window = egptr() - eback();
+
+			if(window > 0 && iposition >= window_ && iposition - window_ <= window) {
+				setg(eback(), eback() + (iposition - window_), egptr());
+				return true;
+			}
+
+			reset_(iposition);
+			return true;
+		}
+
+		// Position in the entry
+		std::size_t tell(void) const { return window_ + (gptr() - eback()); }
+
+		// Entry size once decoded
+		std::size_t size(void) const { return header_.raw; }
+
+		bool is_open(void) const { return grid_ != nullptr; }
+
+		// Did reading run into a broken entry
+		bool failed(void) const { return failed_; }
+
+		Reader(void) = default;
+
+		Reader(const Reader &) = delete;
+		Reader& operator=(const Reader &) = delete;
+
+		~Reader(void) = default;
+
+	protected:
+
+		int_type underflow(void) override {
+			if(gptr() < egptr())
+				return traits_type::to_int_type(*gptr());
+
+			std::size_t position = tell();
+
+			if(!grid_ || failed_ || position >= header_.raw || !fill_(position))
+				return traits_type::eof();
+
+			return traits_type::to_int_type(*gptr());
+		}
+
+		std::streamsize xsgetn(char *odata, std::streamsize isize) override {
+			std::size_t done = 0;
+			std::size_t want = isize > 0 ? (std::size_t)isize : 0;
+
+			while(done < want) {
+				std::size_t available = egptr() - gptr();
+
+				if(available > 0) {
+					std::size_t take = want - done < available ? want - done : available;
+
+					std::memcpy(odata + done, gptr(), take);
+					setg(eback(), gptr() + take, egptr());
+					done += take;
+					continue;
+				}
+
+				std::size_t position = tell();
+
+				if(!grid_ || failed_ || position >= header_.raw)
+					break;
+
+				// Big raw reads go straight into the caller's buffer
+
+				std::size_t rest = header_.raw - position;
+				std::size_t take = want - done < rest ? want - done : rest;
+
+				if(header_.codec == Codec::NONE && take >= format::COMPRESS_BLOCK_SIZE) {
+					if(grid_->read_at_(header_.data + position, odata + done, take) != take) {
+						failed_ = true;
+						break;
+					}
+
+					reset_(position + take);
+					done += take;
+					continue;
+				}
+
+				if(!fill_(position))
+					break;
+			}
+
+			return (std::streamsize)done;
+		}
+
+		std::streamsize showmanyc(void) override {
+			if(!grid_ || failed_ || tell() >= header_.raw)
+				return -1;
+
+			return (std::streamsize)(header_.raw - tell());
+		}
+
+		pos_type seekoff(off_type ioffset, std::ios_base::seekdir idirection, std::ios_base::openmode iwhich) override {
+			if(!(iwhich & std::ios_base::in))
+				return pos_type(off_type(-1));
+
+			off_type from = 0;
+
+			if(idirection == std::ios_base::cur)
+				from = (off_type)tell();
+			else if(idirection == std::ios_base::end)
+				from = (off_type)header_.raw;
+
+			if(from + ioffset < 0 || !seek((std::size_t)(from + ioffset)))
+				return pos_type(off_type(-1));
+
+			return pos_type(from + ioffset);
+		}
+
+		pos_type seekpos(pos_type iposition, std::ios_base::openmode iwhich) override {
+			return seekoff(off_type(iposition), std::ios_base::beg, iwhich);
+		}
+
+	private:
+		friend struct Grid;
+
+		const Grid *grid_ = nullptr;
+		Header header_ = {};
+		// Entry position of the first byte in the get area
+		std::size_t window_ = 0;
+		// Decoded block, or a piece of a raw entry
+		std::vector<char> buffer_;
+		// Stored block read from a stream
+		std::vector<std::uint8_t> stored_;
+		// Image offset of every compressed block found so far
+		std::vector<std::size_t> blocks_;
+		bool failed_ = false;
+
+		void open_(const Grid &igrid, const Header &iheader) {
+			grid_ = &igrid;
+			header_ = iheader;
+			failed_ = false;
+
+			blocks_.clear();
+			if(header_.codec != Codec::NONE)
+				blocks_.push_back(header_.data);
+
+			reset_(0);
+			return;
+		}
+
+		// Drop the get area, the next read starts at iposition.  A
+		// mapped raw entry is the get area itself, nothing is copied
+		void reset_(std::size_t iposition) {
+			if(header_.codec == Codec::NONE && grid_->is_mapped()) {
+				char *data = (char*)grid_->mapping_.data + header_.data;
+
+				window_ = 0;
+				setg(data, data + iposition, data + header_.raw);
+				return;
+			}
+
+			window_ = iposition;
+			setg(nullptr, nullptr, nullptr);
+			return;
+		}
+
+		// Image offset of a compressed block, walks the block
+		// chain as far as it has to
+		bool find_block_(std::size_t iblock, std::size_t &ooffset) {
+			std::size_t end = header_.data + header_.stored;
+
+			while(blocks_.size() <= iblock) {
+				std::size_t at = blocks_.back();
+				std::uint8_t size_bytes[4];
+
+				if(end - at < 4 || grid_->read_at_(at, size_bytes, 4) != 4)
+					return false;
+
+				std::size_t block_size = ((std::uint32_t)size_bytes[0] | ((std::uint32_t)size_bytes[1] << 8) |
+					((std::uint32_t)size_bytes[2] << 16) | ((std::uint32_t)size_bytes[3] << 24)) & ~format::BLOCK_RAW;
+
+				if(end - at - 4 < block_size)
+					return false;
+
+				blocks_.push_back(at + 4 + block_size);
+			}
+
+			ooffset = blocks_[iblock];
+			return true;
+		}
+
+		// Fill the get area so it holds iposition
+		bool fill_(std::size_t iposition) {
+			if(header_.codec == Codec::NONE) {
+				std::size_t rest = header_.raw - iposition;
+				std::size_t take = rest < format::COMPRESS_BLOCK_SIZE ? rest : format::COMPRESS_BLOCK_SIZE;
+
+				buffer_.resize(format::COMPRESS_BLOCK_SIZE);
+
+				if(grid_->read_at_(header_.data + iposition, buffer_.data(), take) != take) {
+					failed_ = true;
+					return false;
+				}
+
+				window_ = iposition;
+				setg(buffer_.data(), buffer_.data(), buffer_.data() + take);
+				return true;
+			}
+
+			std::size_t block = iposition / format::COMPRESS_BLOCK_SIZE;
+			std::size_t block_start = block * format::COMPRESS_BLOCK_SIZE;
+			std::size_t block_raw = header_.raw - block_start < format::COMPRESS_BLOCK_SIZE ? header_.raw - block_start : format::COMPRESS_BLOCK_SIZE;
+			std::size_t offset;
+
+			if(!find_block_(block, offset)) {
+				failed_ = true;
+				return false;
+			}
+
+			std::uint8_t size_bytes[4];
+
+			if(grid_->read_at_(offset, size_bytes, 4) != 4) {
+				failed_ = true;
+				return false;
+			}
+
+			std::uint32_t block_size = (std::uint32_t)size_bytes[0] | ((std::uint32_t)size_bytes[1] << 8) |
+				((std::uint32_t)size_bytes[2] << 16) | ((std::uint32_t)size_bytes[3] << 24);
+			std::size_t stored = block_size & ~format::BLOCK_RAW;
+			bool last = block_start + block_raw == header_.raw;
+
+			// The last block has to end right where the entry does
+			if(header_.data + header_.stored - offset - 4 < stored ||
+					(last && offset + 4 + stored != header_.data + header_.stored)) {
+				failed_ = true;
+				return false;
+			}
+
+			const std::uint8_t *in;
+
+			if(grid_->is_mapped()) {
+				in = (const std::uint8_t*)grid_->mapping_.data + offset + 4;
+			} else {
+				stored_.resize(stored);
+
+				if(grid_->read_at_(offset + 4, stored_.data(), stored) != stored) {
+					failed_ = true;
+					return false;
+				}
+
+				in = stored_.data();
+			}
+
+			buffer_.resize(format::COMPRESS_BLOCK_SIZE);
+
+			if(block_size & format::BLOCK_RAW) {
+				if(stored != block_raw) {
+					failed_ = true;
+					return false;
+				}
+
+				std::memcpy(buffer_.data(), in, block_raw);
+			} else if(!decode_lz4_block_(in, stored, (std::uint8_t*)buffer_.data(), block_raw)) {
+				failed_ = true;
+				return false;
+			}
+
+			window_ = block_start;
+			setg(buffer_.data(), buffer_.data() + (iposition - block_start), buffer_.data() + block_raw);
+			return true;
+		}
+	};
+
+	// Reads entries in the background, many of them at once.  On
+	// Linux they go through io_uring, elsewhere, or if io_uring
+	// cannot be set up, through a few threads doing plain reads.
+	// Callbacks run on a background thread and must not throw.
+	// Must not outlive the grid it was made for
+	struct Async {
+		// Was the entry read, and its content
+		using Callback = std::function<void(bool, std::vector<char>&&)>;
+
+		// Read entry at ioffset, a file that was not found fails
+		// right away on the calling thread
+		void read(std::size_t ioffset, Callback icallback) {
+			if(!ioffset) {
+				std::vector<char> none;
+				icallback(false, std::move(none));
+				return;
+			}
+
+			Request *request = new Request;
+			request->offset = ioffset;
+			request->callback = std::move(icallback);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				++pending_;
+			}
+
+#if GRID_URING
+			if(ring_.fd >= 0) {
+				start_(request);
+				return;
+			}
+#endif
+
+			pool_->execute([this, request](void) -> void {
+				bool read = grid_->get_file_content(request->offset, request->data);
+				finish_(request, read);
+			});
+
+			return;
+		}
+
+		// Read entry at ioffset, the future throws if it cannot be read
+		std::future<std::vector<char>> read(std::size_t ioffset) {
+			auto promise = std::make_shared<std::promise<std::vector<char>>>();
+			std::future<std::vector<char>> future = promise->get_future();
+
+			read(ioffset, [promise](bool iread, std::vector<char> &&idata) -> void {
+				if(iread)
+					promise->set_value(std::move(idata));
+				else
+					promise->set_exception(std::make_exception_ptr(std::ios_base::failure("Unable to read file")));
+			});
+
+			return future;
+		}
+
+		// Read file
+		void read(const Path &ipath, Callback icallback) { read(grid_->find_file(ipath), std::move(icallback)); }
+		std::future<std::vector<char>> read(const Path &ipath) { return read(grid_->find_file(ipath)); }
+
+		// Read file by path string
+		template<PathString S>
+		void read(const S &ipath, Callback icallback) { read(grid_->find_file(ipath), std::move(icallback)); }
+		template<PathString S>
+		std::future<std::vector<char>> read(const S &ipath) { return read(grid_->find_file(ipath)); }
+
+		// Wait until every read so far is done
+		void wait(void) {
+			std::unique_lock<std::mutex> lock(mutex_);
+			idle_.wait(lock, [this](void) -> bool { return pending_ == 0; });
+			return;
+		}
+
+		// Are reads going through io_uring
+		bool is_uring(void) const noexcept {
+#if GRID_URING
+			return ring_.fd >= 0;
+#else
+			return false;
+#endif
+		}
+
+		// Up to idepth reads are in flight at once, the rest wait for their turn
+		Async(const Grid &igrid, unsigned idepth = 64) : grid_(&igrid), depth_(idepth ? idepth : 1) {
+#if GRID_URING
+			if(igrid.file_.fd >= 0 && ring_.open(depth_)) {
+				depth_ = ring_.entries;
+				reaper_ = std::thread(&Async::reap_, this);
+				return;
+			}
+#endif
+			unsigned threads = std::thread::hardware_concurrency();
+			if(threads < 2)
+				threads = 2;
+			if(threads > depth_)
+				threads = depth_;
+
+			pool_ = std::make_unique<Pool>(threads);
+		}
+
+		Async(const Async &) = delete;
+		Async& operator=(const Async &) = delete;
+
+		// Waits for every read to be done
+		~Async(void) {
+			wait();
+
+			pool_.reset();
+
+#if GRID_URING
+			if(ring_.fd >= 0) {
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					stopping_ = true;
+				}
+
+				wake_.notify_all();
+				reaper_.join();
+			}
+#endif
+		}
+
+	private:
+
+		struct Request {
+			std::size_t offset;
+			Callback callback;
+			std::vector<char> data;
+
+			Header header;
+			bool have_header = false;
+			// Entry header and whatever data came with it
+			std::vector<std::byte> peek;
+			// Stored data of a compressed entry
+			std::vector<std::byte> stored;
+
+			// Image range being read
+			std::size_t at = 0;
+			std::byte *target = nullptr;
+			std::size_t size = 0;
+			std::size_t done = 0;
+#if GRID_URING
+			struct iovec vector;
+#endif
+		};
+
+		const Grid *grid_;
+		unsigned depth_;
+
+		std::mutex mutex_;
+		std::condition_variable idle_;
+		// Submitted reads that have not called back yet
+		std::size_t pending_ = 0;
+
+		// Plain reads when there is no ring
+		std::unique_ptr<Pool> pool_;
+
+		// Report a read and forget it
+		void finish_(Request *irequest, bool iread) {
+			if(!iread)
+				irequest->data.clear();
+
+			irequest->callback(iread, std::move(irequest->data));
+			delete irequest;
+
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			if(--pending_ == 0)
+				idle_.notify_all();
+
+			return;
+		}
+
+#if GRID_URING
+		// Bare io_uring, only what reads need
+		struct Ring {
+			int fd = -1;
+			unsigned entries = 0;
+
+			void *sq_ring = nullptr;
+			void *cq_ring = nullptr;
+			std::size_t sq_ring_size = 0;
+			std::size_t cq_ring_size = 0;
+			struct io_uring_sqe *sqes = nullptr;
+			std::size_t sqes_size = 0;
+
+			unsigned *sq_tail = nullptr;
+			unsigned *sq_mask = nullptr;
+			unsigned *sq_array = nullptr;
+			unsigned *cq_head = nullptr;
+			unsigned *cq_tail = nullptr;
+			unsigned *cq_mask = nullptr;
+			struct io_uring_cqe *cqes = nullptr;
+
+			// Queued entries the kernel has not taken yet
+			unsigned unsubmitted = 0;
+
+			bool open(unsigned idepth) {
+				struct io_uring_params params;
+				std::memset(&params, 0, sizeof(params));
+
+				fd = (int)::syscall(__NR_io_uring_setup, idepth, &params);
+				if(fd < 0)
+					return false;
+
+				sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+				cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+				bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+
+				if(single) {
+					if(cq_ring_size > sq_ring_size)
+						sq_ring_size = cq_ring_size;
+					cq_ring_size = sq_ring_size;
+				}
+
+				sq_ring = ::mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+				if(sq_ring == MAP_FAILED) {
+					sq_ring = nullptr;
+					close();
+					return false;
+				}
+
+				if(single) {
+					cq_ring = sq_ring;
+				} else {
+					cq_ring = ::mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+					if(cq_ring == MAP_FAILED) {
+						cq_ring = nullptr;
+						close();
+						return false;
+					}
+				}
+
+				sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+				void *sqes_map = ::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+				if(sqes_map == MAP_FAILED) {
+					close();
+					return false;
+				}
+
+				sqes = static_cast<struct io_uring_sqe*>(sqes_map);
+
+				char *sq = static_cast<char*>(sq_ring);
+				char *cq = static_cast<char*>(cq_ring);
+
+				sq_tail = (unsigned*)(sq + params.sq_off.tail);
+				sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+				sq_array = (unsigned*)(sq + params.sq_off.array);
+				cq_head = (unsigned*)(cq + params.cq_off.head);
+				cq_tail = (unsigned*)(cq + params.cq_off.tail);
+				cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+				cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+				entries = params.sq_entries;
+				return true;
+			}
+
+			void close(void) noexcept {
+				if(sqes)
+					::munmap(sqes, sqes_size);
+				if(cq_ring && cq_ring != sq_ring)
+					::munmap(cq_ring, cq_ring_size);
+				if(sq_ring)
+					::munmap(sq_ring, sq_ring_size);
+				if(fd >= 0)
+					::close(fd);
+
+				fd = -1;
+				sqes = nullptr;
+				sq_ring = cq_ring = nullptr;
+				return;
+			}
+
+			// Queue an entry, there has to be room for it
+			struct io_uring_sqe& push_(std::uint64_t iuser) {
+				unsigned tail = *sq_tail;
+				unsigned index = tail & *sq_mask;
+
+				struct io_uring_sqe &sqe = sqes[index];
+				std::memset(&sqe, 0, sizeof(sqe));
+				sqe.user_data = iuser;
+
+				sq_array[index] = index;
+				std::atomic_ref<unsigned>(*sq_tail).store(tail + 1, std::memory_order_release);
+
+				++unsubmitted;
+				return sqe;
+			}
+
+			void push_read(int ifd, struct iovec *ivector, std::size_t ioffset, std::uint64_t iuser) {
+				struct io_uring_sqe &sqe = push_(iuser);
+				sqe.opcode = IORING_OP_READV;
+				sqe.fd = ifd;
+				sqe.addr = (std::uint64_t)(std::uintptr_t)ivector;
+				sqe.len = 1;
+				sqe.off = ioffset;
+				return;
+			}
+
+			void push_nop(std::uint64_t iuser) {
+				struct io_uring_sqe &sqe = push_(iuser);
+				sqe.opcode = IORING_OP_NOP;
+				return;
+			}
+
+			// Hand queued entries to the kernel, false if it refuses
+			// them for good.  Entries it has no room for right now
+			// stay queued for the next call
+			bool submit(void) {
+				while(unsubmitted > 0) {
+					long taken = ::syscall(__NR_io_uring_enter, fd, unsubmitted, 0, 0, nullptr, 0);
+
+					if(taken < 0 && errno == EINTR)
+						continue;
+					if(taken == 0 || (taken < 0 && (errno == EAGAIN || errno == EBUSY)))
+						return true;
+					if(taken < 0)
+						return false;
+
+					unsubmitted -= (unsigned)taken;
+				}
+
+				return true;
+			}
+
+			// Take back the queued entries the kernel has not taken,
+			// their user data go to ouser
+			void take_back(std::vector<std::uint64_t> &ouser) {
+				unsigned tail = *sq_tail;
+
+				for(unsigned i = unsubmitted; i > 0; --i)
+					ouser.push_back(sqes[sq_array[(tail - i) & *sq_mask]].user_data);
+
+				std::atomic_ref<unsigned>(*sq_tail).store(tail - unsubmitted, std::memory_order_release);
+				unsubmitted = 0;
+				return;
+			}
+
+			// Take a completion if there is one
+			bool pop(struct io_uring_cqe &ocqe) {
+				unsigned head = *cq_head;
+
+				if(head == std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire))
+					return false;
+
+				ocqe = cqes[head & *cq_mask];
+				std::atomic_ref<unsigned>(*cq_head).store(head + 1, std::memory_order_release);
+				return true;
+			}
+
+			// Wait for a completion
+			void wait(void) {
+				::syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+				return;
+			}
+
+			Ring(void) = default;
+
+			Ring(const Ring &) = delete;
+			Ring& operator=(const Ring &) = delete;
+
+			~Ring(void) { close(); }
+		};
+
+		// Headers are read together with this many bytes after
+		// them, small entries are done in a single read
+		static constexpr std::size_t PEEK_SIZE = 4 * 1024;
+		// Longest single read
+		static constexpr std::size_t READ_SIZE_MAX = 1u << 30;
+
+		// Completion that does not belong to a read
+		static constexpr std::uint64_t WAKE = 1;
+
+		Ring ring_;
+		std::thread reaper_;
+		// Reads waiting for a ring slot
+		std::deque<Request*> waiting_;
+		// Requests that hold a ring slot
+		unsigned in_ring_ = 0;
+		// Is the completion thread waiting in the kernel, and was it woken up already
+		bool sleeping_ = false;
+		bool woken_ = false;
+		// With no reads in flight the completion thread waits here
+		// instead, so it can be woken up even when the ring fails
+		std::condition_variable wake_;
+		bool stopping_ = false;
+
+		// Queue the next piece of the range being read, mutex_ has to be held
+		void push_(Request *irequest) {
+			std::size_t rest = irequest->size - irequest->done;
+
+			irequest->vector.iov_base = irequest->target + irequest->done;
+			irequest->vector.iov_len = rest < READ_SIZE_MAX ? rest : READ_SIZE_MAX;
+
+			ring_.push_read(grid_->file_.fd, &irequest->vector, irequest->at + irequest->done, (std::uint64_t)(std::uintptr_t)irequest);
+			return;
+		}
+
+		// Hand a read to the completion thread.  Reads are only ever
+		// queued by it, so the kernel completes all of them on one thread
+		void start_(Request *irequest) {
+			if(irequest->offset >= grid_->file_.size) {
+				finish_(irequest, false);
+				return;
+			}
+
+			std::lock_guard<std::mutex> lock(mutex_);
+			waiting_.push_back(irequest);
+
+			// A wake-up the kernel refuses stays queued, the reads in
+			// flight wake the completion thread up anyway
+			if(sleeping_ && !woken_) {
+				ring_.push_nop(WAKE);
+				ring_.submit();
+				woken_ = true;
+			}
+
+			wake_.notify_one();
+			return;
+		}
+
+		// A range is read in full, move on to the next one or finish
+		bool advance_(Request *irequest, bool &ofinished) {
+			ofinished = false;
+
+			if(!irequest->have_header) {
+				Request &request = *irequest;
+
+				if(!grid_->parse_header_(request.offset, (const std::uint8_t*)request.peek.data(), request.peek.size(), request.header))
+					return false;
+
+				request.have_header = true;
+
+				// Take what came in with the header
+
+				std::size_t with_header = request.offset + request.peek.size() - request.header.data;
+				std::size_t held = with_header < request.header.stored ? with_header : request.header.stored;
+				const std::byte *from = request.peek.data() + (request.header.data - request.offset);
+
+				request.data.resize(request.header.raw);
+
+				std::byte *to = (std::byte*)request.data.data();
+
+				if(request.header.codec != Codec::NONE) {
+					request.stored.resize(request.header.stored);
+					to = request.stored.data();
+				}
+
+				if(held)
+					std::memcpy(to, from, held);
+
+				request.peek.clear();
+				request.peek.shrink_to_fit();
+
+				if(held < request.header.stored) {
+					request.at = request.header.data + held;
+					request.target = to + held;
+					request.size = request.header.stored - held;
+					request.done = 0;
+					return true;
+				}
+			}
+
+			ofinished = true;
+
+			if(irequest->header.codec == Codec::NONE)
+				return grid_->checked_(irequest->header, std::span<const std::byte>((const std::byte*)irequest->data.data(), irequest->data.size()));
+
+			return grid_->checked_(irequest->header, irequest->stored) && decode_(irequest->header.codec, irequest->stored,
+				std::span<std::byte>((std::byte*)irequest->data.data(), irequest->data.size()));
+		}
+
+		// Handle a completed piece of a read
+		void complete_(Request *irequest, int iresult) {
+			bool failed = false;
+			bool finished = false;
+
+			if(iresult == -EINTR || iresult == -EAGAIN) {
+				// Try that piece again
+			} else if(iresult <= 0) {
+				failed = true;
+			} else {
+				irequest->done += (std::size_t)iresult;
+
+				if(irequest->done >= irequest->size)
+					failed = !advance_(irequest, finished);
+			}
+
+			if(!failed && !finished) {
+				std::lock_guard<std::mutex> lock(mutex_);
+				push_(irequest);
+				return;
+			}
+
+			finish_(irequest, !failed);
+
+			std::lock_guard<std::mutex> lock(mutex_);
+			--in_ring_;
+			return;
+		}
+
+		// Ring completion thread
+		void reap_(void) {
+			for(;;) {
+				std::vector<std::uint64_t> refused;
+
+				// Waiting reads take the free slots
+
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+
+					while(in_ring_ < depth_ && !waiting_.empty()) {
+						Request *request = waiting_.front();
+						waiting_.pop_front();
+
+						// The header is read together with the start of the data
+						std::size_t peek = grid_->file_.size - request->offset;
+
+						if(peek > HEADER_SIZE_MAX + PEEK_SIZE)
+							peek = HEADER_SIZE_MAX + PEEK_SIZE;
+
+						request->peek.resize(peek);
+						request->at = request->offset;
+						request->target = request->peek.data();
+						request->size = peek;
+						request->done = 0;
+
+						++in_ring_;
+						push_(request);
+					}
+
+					if(!ring_.submit())
+						ring_.take_back(refused);
+				}
+
+				// Reads the kernel refused fail and give up their slots
+
+				for(std::uint64_t user : refused) {
+					if(user == WAKE)
+						continue;
+
+					finish_((Request*)(std::uintptr_t)user, false);
+
+					std::lock_guard<std::mutex> lock(mutex_);
+					--in_ring_;
+				}
+
+				// Handle every completion there is, they are taken under
+				// the lock their reads were queued under
+
+				bool any = false;
+
+				for(;;) {
+					struct io_uring_cqe cqe;
+
+					{
+						std::lock_guard<std::mutex> lock(mutex_);
+
+						if(!ring_.pop(cqe))
+							break;
+					}
+
+					any = true;
+
+					if(cqe.user_data == WAKE)
+						continue;
+
+					complete_((Request*)(std::uintptr_t)cqe.user_data, cqe.res);
+				}
+
+				if(any || !refused.empty())
+					continue;
+
+				// Nothing to do, sleep until a read completes or a new one comes
+
+				{
+					std::unique_lock<std::mutex> lock(mutex_);
+
+					if(in_ring_ < depth_ && !waiting_.empty())
+						continue;
+
+					// The kernel had no room, try again
+					if(ring_.unsubmitted > 0) {
+						lock.unlock();
+						std::this_thread::yield();
+						continue;
+					}
+
+					if(in_ring_ == 0) {
+						wake_.wait(lock, [this](void) -> bool { return stopping_ || !waiting_.empty(); });
+
+						if(waiting_.empty())
+							return;
+
+						continue;
+					}
+
+					sleeping_ = true;
+				}
+
+				ring_.wait();
+
+				std::lock_guard<std::mutex> lock(mutex_);
+				sleeping_ = false;
+				woken_ = false;
+			}
+		}
+#endif
+	};
+
+	// What co_await on read_async() waits for, gives the content of
+	// the file or throws if it cannot be read
+	struct Reading {
+		// Starts the read, calls back once it is done
+		using Start = std::function<void(Async::Callback)>;
+
+		bool await_ready(void) const noexcept { return !offset_; }
+
+		void await_suspend(std::coroutine_handle<> ihandle) {
+			// The coroutine may be resumed and this awaiter gone
+			// before start returns, so nothing here is touched after
+			Start start = std::move(start_);
+
+			start([this, ihandle](bool iread, std::vector<char> &&idata) -> void {
+				read_ = iread;
+				data_ = std::move(idata);
+				ihandle.resume();
+			});
+		}
+
+		std::vector<char> await_resume(void) {
+			if(!read_)
+				throw std::ios_base::failure("Unable to read file");
+
+			return std::move(data_);
+		}
+
+		Reading(std::size_t ioffset, Start istart) : offset_(ioffset), start_(std::move(istart)) {}
+
+	private:
+		std::size_t offset_;
+		Start start_;
+		bool read_ = false;
+		std::vector<char> data_;
+	};
+
+	// Keeps recently read files in memory, up to a budget of bytes.
+	// It is split into shards by entry offset, each one with its
+	// own lock, so threads reading different files rarely meet.
+	// Must not outlive the grid it was made for
+	struct Cache {
+		// Shared file content, it never changes
+		struct Content {
+			std::shared_ptr<const std::byte[]> data;
+			std::size_t size = 0;
+
+			std::span<const std::byte> view(void) const { return std::span<const std::byte>(data.get(), size); }
+		};
+
+		// Get file content, from memory if it is there
+		bool get_file_content(std::size_t ioffset, Content &ocontent) {
+			if(!ioffset)
+				return false;
+
+			Shard &shard = shards_[(ioffset * 0x9e3779b97f4a7c15ull >> 32) % shard_count_];
+
+			{
+				std::lock_guard<std::mutex> lock(shard.mutex);
+
+				auto found = shard.items.find(ioffset);
+
+				if(found != shard.items.end()) {
+					shard.order.splice(shard.order.begin(), shard.order, found->second);
+					ocontent = found->second->content;
+					++shard.hits;
+					return true;
+				}
+
+				++shard.misses;
+			}
+
+			// Read it without holding the lock
+
+			Header header;
+			if(!grid_->read_header_(ioffset, header))
+				return false;
+
+			std::shared_ptr<std::byte[]> data(new std::byte[header.raw ? header.raw : 1]);
+
+			if(!grid_->read_content_(header, std::span<std::byte>(data.get(), header.raw)))
+				return false;
+
+			ocontent.data = std::move(data);
+			ocontent.size = header.raw;
+
+			// Files bigger than a shard are never kept
+			if(ocontent.size > shard_budget_)
+				return true;
+
+			std::lock_guard<std::mutex> lock(shard.mutex);
+
+			// Someone else may have read it meanwhile
+			if(shard.items.find(ioffset) != shard.items.end())
+				return true;
+
+			shard.order.push_front({ ioffset, ocontent });
+			shard.items.emplace(ioffset, shard.order.begin());
+			shard.bytes += ocontent.size;
+
+			while(shard.bytes > shard_budget_) {
+				shard.bytes -= shard.order.back().content.size;
+				shard.items.erase(shard.order.back().offset);
+				shard.order.pop_back();
+			}
+
+			return true;
+		}
+
+		// Read file
+		bool read(const Path &ipath, Content &ocontent) { return get_file_content(grid_->find_file(ipath), ocontent); }
+
+		// Read file by path string
+		template<PathString S>
+		bool read(const S &ipath, Content &ocontent) { return get_file_content(grid_->find_file(ipath), ocontent); }
+
+		// Reads served from memory
+		std::uint64_t hits(void) const {
+			std::uint64_t total = 0;
+
+			for(std::size_t i = 0; i < shard_count_; ++i) {
+				std::lock_guard<std::mutex> lock(shards_[i].mutex);
+				total += shards_[i].hits;
+			}
+
+			return total;
+		}
+
+		// Reads that went to the image
+		std::uint64_t misses(void) const {
+			std::uint64_t total = 0;
+
+			for(std::size_t i = 0; i < shard_count_; ++i) {
+				std::lock_guard<std::mutex> lock(shards_[i].mutex);
+				total += shards_[i].misses;
+			}
+
+			return total;
+		}
+
+		// Bytes kept in memory, content that is still shared out
+		// after it was dropped is not counted
+		std::size_t size(void) const {
+			std::size_t total = 0;
+
+			for(std::size_t i = 0; i < shard_count_; ++i) {
+				std::lock_guard<std::mutex> lock(shards_[i].mutex);
+				total += shards_[i].bytes;
+			}
+
+			return total;
+		}
+
+		// Drop everything, counters are kept
+		void clear(void) {
+			for(std::size_t i = 0; i < shard_count_; ++i) {
+				std::lock_guard<std::mutex> lock(shards_[i].mutex);
+
+				shards_[i].items.clear();
+				shards_[i].order.clear();
+				shards_[i].bytes = 0;
+			}
+
+			return;
+		}
+
+		// ibudget bytes are split evenly between ishards shards
+		Cache(const Grid &igrid, std::size_t ibudget, std::size_t ishards = 16)
+			: grid_(&igrid), shard_count_(ishards ? ishards : 1) {
+			shards_ = std::make_unique<Shard[]>(shard_count_);
+			shard_budget_ = ibudget / shard_count_;
+		}
+
+		Cache(const Cache &) = delete;
+		Cache& operator=(const Cache &) = delete;
+
+	private:
+
+		struct Item {
+			std::size_t offset;
+			Content content;
+		};
+
+		struct alignas(64) Shard {
+			mutable std::mutex mutex;
+			// Most recently used first
+			std::list<Item> order;
+			std::unordered_map<std::size_t, std::list<Item>::iterator> items;
+			std::size_t bytes = 0;
+			std::uint64_t hits = 0;
+			std::uint64_t misses = 0;
+		};
+
+		const Grid *grid_;
+		std::size_t shard_count_;
+		std::size_t shard_budget_;
+		std::unique_ptr<Shard[]> shards_;
+	};
+
+public:
+	Table table;
+
+public:
+
+	// Make sure the table is read in, only LAZY grids have to
+	// before looking into a table by hand
+	bool load(const Table &itable) const {
+		std::uint8_t state = itable.state_.load(std::memory_order_acquire);
+
+		while(state != Table::LOADED) {
+			if(state == Table::BROKEN)
+				return false;
+
+			if(state == Table::LOADING) {
+				itable.state_.wait(Table::LOADING, std::memory_order_acquire);
+				state = itable.state_.load(std::memory_order_acquire);
+				continue;
+			}
+
+			// This thread reads the table in, the others wait for it
+
+			if(!itable.state_.compare_exchange_weak(state, Table::LOADING, std::memory_order_acquire))
+				continue;
+
+			bool loaded = read_in_table_(itable.offset_, const_cast<Table&>(itable));
+
+			itable.state_.store(loaded ? Table::LOADED : Table::BROKEN, std::memory_order_release);
+			itable.state_.notify_all();
+
+			return loaded;
+		}
+
+		return true;
+	}
+
+	bool find_parent_table(const Path &ipath, const Table* &otable) const {
+		if(ipath.empty() || !otable)
+			return false;
+
+		for(std::size_t i = 0; i < ipath.path.size() - 1; ++i) {
+			if(!load(*otable))
+				return false;
+
+			const Table *nested = otable->find_table(ipath.path[i]);
+
+			if(!nested)
+				return false;
+
+			otable = nested;
+		}
+
+		return load(*otable);
+	}
+
+	// Is directory in directory
+	bool is_directory(const Path &ipath, const Table &itable) const {
+		if(ipath.empty())
+			return false;
+
+		// Searching for the directory by path
+
+		const Table *actual = &itable;
+		if(!find_parent_table(ipath, actual))
+			return false;
+
+		return actual->find_directory(ipath.path.back()) != nullptr;
+	}
+
+	// Is directory
+	bool is_directory(const Path &ipath) const {
+		char type;
+		Entry target;
+
+		return lookup_(ipath, type, target) && type == 'd';
+	}
+
+	// Is directory, by path string without allocating
+	template<PathString S>
+	bool is_directory(const S &ipath) const {
+		char type;
+		Entry target;
+
+		return lookup_(PathComponents{ ipath }, type, target) && type == 'd';
+	}
+
+	// Is regular file in directory
+	bool is_regular_file(const Path &ipath, const Table &itable) const {
+		if(ipath.empty())
+			return false;
+
+		// Searching for the entry by path
+
+		const Table *actual = &itable;
+		if(!find_parent_table(ipath, actual))
+			return false;
+
+		return actual->find_file(ipath.path.back()) != nullptr;
+	}
+
+	// Is regular file
+	bool is_regular_file(const Path &ipath) const {
+		char type;
+		Entry target;
+
+		return lookup_(ipath, type, target) && type == 'f';
+	}
+
+	// Is regular file, by path string without allocating
+	template<PathString S>
+	bool is_regular_file(const S &ipath) const {
+		char type;
+		Entry target;
+
+		return lookup_(PathComponents{ ipath }, type, target) && type == 'f';
+	}
+
+	// Exists in directory
+	bool exists(const Path &ipath, const Table &itable) const {
+		if(ipath.empty())
+			return false;
+
+		// Searching for the entry by path
+
+		const Table *actual = &itable;
+		if(!find_parent_table(ipath, actual))
+			return false;
+
+		return actual->find_directory(ipath.path.back()) || actual->find_file(ipath.path.back());
+	}
+
+	// Exists
+	bool exists(const Path &ipath) const {
+		char type;
+		Entry target;
+
+		return lookup_(ipath, type, target);
+	}
+
+	// Exists, by path string without allocating
+	template<PathString S>
+	bool exists(const S &ipath) const {
+		char type;
+		Entry target;
+
+		return lookup_(PathComponents{ ipath }, type, target);
+	}
+
+	// Find directory in directory
+	bool find_directory(const Path &ipath, Table &otable, const Table &itable) const {
+		if(ipath.empty())
+			return false;
+
+		// Searching for the directory by path
+
+		const Table *actual = &itable;
+		if(!find_parent_table(ipath, actual))
+			return false;
+
+		// Take a table from the directory
+
+		{
+			const Table *found = actual->find_table(ipath.path.back());
+
+			if(!found)
+				return false;
+
+			if(!load(*found))
+				return false;
+
+			otable = *found;
+		}
+
+		return true;
+	}
+
+	// Find directory
+	bool find_directory(const Path &ipath, Table &otable) const {
+		return find_directory(ipath, otable, table);
+	}
+
+	// Find directory without copying its table, an empty path is the root
+	bool find_directory(const Path &ipath, Directory &odirectory) const {
+		const Table *found = find_table_(ipath);
+
+		if(!found)
+			return false;
+
+		odirectory = Directory(found);
+		return true;
+	}
+
+	// Find directory by path string without copying its table
+	template<PathString S>
+	bool find_directory(const S &ipath, Directory &odirectory) const {
+		const Table *found = find_table_(PathComponents{ ipath });
+
+		if(!found)
+			return false;
+
+		odirectory = Directory(found);
+		return true;
+	}
+
+	// Root directory
+	Directory root(void) const { return Directory(&table); }
+
+	// Type, target, size and time of a path, out of the tables
+	// without touching the entry, once they are read in.  Images
+	// without sizes have the entry header read, see has_sizes()
+	bool stat(const Path &ipath, Stat &ostat) const { return stat_(ipath, ostat); }
+
+	// Stat by path string without allocating
+	template<PathString S>
+	bool stat(const S &ipath, Stat &ostat) const { return stat_(PathComponents{ ipath }, ostat); }
+
+	// Do the tables hold the size of every file
+	bool has_sizes(void) const noexcept { return sizes_; }
+
+	// Do the tables hold the last write time of every file
+	bool has_times(void) const noexcept { return times_; }
+
+	// Walk through a directory and every nested one
+	Walk walk(const Directory &idirectory) const { return Walk(this, idirectory.table_); }
+
+	// Find file in directory
+	std::size_t find_file(const Path &ipath, const Table &itable) const {
+		if(ipath.empty())
+			return 0;
+
+		std::size_t offset = 0;
+
+		// Searching for the entry by path
+
+		const Table *actual = &itable;
+		if(!find_parent_table(ipath, actual))
+			return false;
+
+		// Take an offset from the entry
+
+		{
+			const Table::Node *found = actual->find_file(ipath.path.back());
+
+			if(!found)
+				return 0;
+
+			offset = found->target;
+		}
+
+		return offset;
+	}
+
+	// Find file
+	std::size_t find_file(const Path &ipath) const {
+		char type;
+		Entry target;
+
+		return lookup_(ipath, type, target) && type == 'f' ? target : 0;
+	}
+
+	// Find file by path string without allocating, a single probe
+	// without splitting the path when the image has a path index
+	template<PathString S>
+	std::size_t find_file(const S &ipath) const {
+		char type;
+		Entry target;
+
+		return lookup_(PathComponents{ ipath }, type, target) && type == 'f' ? target : 0;
+	}
+
+	// Is the image mapped into memory
+	bool is_mapped(void) const noexcept { return mapping_.data != nullptr; }
+
+	// Format version of the image, 1 for images without a versioned header
+	std::uint16_t version(void) const noexcept { return version_; }
+
+	// Does the image have a full path index
+	bool is_indexed(void) const noexcept { return index_slots_ != 0; }
+
+	// View file content in place, only works for mapped images
+	// and entries that are not compressed
+	bool view_file_content(std::size_t ioffset, std::span<const std::byte> &oview) const {
+		if(!is_mapped())
+			return false;
+
+		Header header;
+		if(!read_header_(ioffset, header) || header.codec != Codec::NONE)
+			return false;
+
+		oview = std::span<const std::byte>(mapping_.data + header.data, header.stored);
+		return checked_(header, oview);
+	}
+
+	// View file in directory
+	bool view(const Path &ipath, std::span<const std::byte> &oview, const Table &itable) const {
+		if(ipath.empty())
+			return false;
+
+		std::size_t offset = find_file(ipath, itable);
+		if(!offset)
+			return false;
+
+		return view_file_content(offset, oview);
+	}
+
+	// View file
+	bool view(const Path &ipath, std::span<const std::byte> &oview) const {
+		std::size_t offset = find_file(ipath);
+		if(!offset)
+			return false;
+
+		return view_file_content(offset, oview);
+	}
+
+	// View file by path string
+	template<PathString S>
+	bool view(const S &ipath, std::span<const std::byte> &oview) const {
+		std::size_t offset = find_file(ipath);
+		if(!offset)
+			return false;
+
+		return view_file_content(offset, oview);
+	}
+
+	// Get file header, tells how the file is stored
+	bool get_file_header(std::size_t ioffset, Header &oheader) const {
+		return ioffset && read_header_(ioffset, oheader);
+	}
+
+	// Check the stored data of a file against its checksum, no matter
+	// how the grid was opened.  A file without one passes, its header
+	// tells it apart
+	bool verify_file_content(std::size_t ioffset) const {
+		Header header;
+		if(!get_file_header(ioffset, header))
+			return false;
+
+		if(!header.checksummed)
+			return true;
+
+		if(is_mapped())
+			return crc32c(mapping_.data + header.data, header.stored) == header.checksum;
+
+		// Read in chunks, so memory use does not grow with the entry
+
+		std::vector<std::byte> chunk(header.stored < BATCH_CHUNK ? header.stored : BATCH_CHUNK);
+		std::uint32_t crc = 0;
+
+		for(std::size_t at = 0; at < header.stored; at += chunk.size()) {
+			std::size_t take = header.stored - at < chunk.size() ? header.stored - at : chunk.size();
+
+			if(file_.read_at(header.data + at, chunk.data(), take) != take)
+				return false;
+
+			crc = crc32c(chunk.data(), take, crc);
+		}
+
+		return crc == header.checksum;
+	}
+
+	// Get file content, compressed entries are decompressed
+	bool get_file_content(std::size_t ioffset, std::vector<char> &odata) const {
+		Header header;
+		if(!read_header_(ioffset, header))
+			return false;
+
+		odata.resize(header.raw);
+
+		return read_content_(header, std::span<std::byte>((std::byte*)odata.data(), odata.size()));
+	}
+
+	// Get file content into a buffer of the caller, nothing is
+	// cleared.  owritten is the raw size of the file, if the buffer
+	// is too small it is what it takes and false is returned.
+	// Nothing is allocated either, unless a compressed file is read
+	// as a stream and its stored data does not fit in the buffer
+	// past the content
+	bool get_file_content(std::size_t ioffset, std::span<std::byte> obuffer, std::size_t &owritten) const {
+		Header header;
+		owritten = 0;
+
+		if(!read_header_(ioffset, header))
+			return false;
+
+		owritten = header.raw;
+
+		if(obuffer.size() < header.raw)
+			return false;
+
+		if(!is_mapped() && header.codec != Codec::NONE && obuffer.size() - header.raw >= header.stored) {
+			std::span<std::byte> stored = obuffer.subspan(header.raw, header.stored);
+
+			if(file_.read_at(header.data, stored.data(), stored.size()) != stored.size())
+				return false;
+
+			return checked_(header, stored) && decode_(header.codec, stored, obuffer.first(header.raw));
+		}
+
+		return read_content_(header, obuffer.first(header.raw));
+	}
+
+	// Get file size, what a read of it gives
+	bool get_file_size(std::size_t ioffset, std::size_t &osize) const {
+		Header header;
+
+		if(!get_file_header(ioffset, header))
+			return false;
+
+		osize = header.raw;
+		return true;
+	}
+
+	// Read file into a buffer of the caller, see get_file_content()
+	bool read(const Path &ipath, std::span<std::byte> obuffer, std::size_t &owritten) const {
+		owritten = 0;
+
+		std::size_t offset = find_file(ipath);
+		if(!offset)
+			return false;
+
+		return get_file_content(offset, obuffer, owritten);
+	}
+
+	// Read file by path string into a buffer of the caller
+	template<PathString S>
+	bool read(const S &ipath, std::span<std::byte> obuffer, std::size_t &owritten) const {
+		owritten = 0;
+
+		std::size_t offset = find_file(ipath);
+		if(!offset)
+			return false;
+
+		return get_file_content(offset, obuffer, owritten);
+	}
+
+	// File size, out of the tables if the image has sizes in them
+	bool file_size(const Path &ipath, std::size_t &osize) const {
+		Stat found;
+
+		if(!stat_(ipath, found) || found.type != 'f')
+			return false;
+
+		osize = found.size;
+		return true;
+	}
+
+	// File size by path string
+	template<PathString S>
+	bool file_size(const S &ipath, std::size_t &osize) const {
+		Stat found;
+
+		if(!stat_(PathComponents{ ipath }, found) || found.type != 'f')
+			return false;
+
+		osize = found.size;
+		return true;
+	}
+
+	// Read file in directory
+	bool read(const Path &ipath, std::vector<char> &odata, const Table &itable) const {
+		if(ipath.empty())
+			return false;
+
+		std::size_t offset = find_file(ipath, itable);
+		if(!offset)
+			return false;
+
+		return get_file_content(offset, odata);
+	}
+
+	// Read file
+	bool read(const Path &ipath, std::vector<char> &odata) const {
+		std::size_t offset = find_file(ipath);
+		if(!offset)
+			return false;
+
+		return get_file_content(offset, odata);
+	}
+
+	// Read file by path string
+	template<PathString S>
+	bool read(const S &ipath, std::vector<char> &odata) const {
+		std::size_t offset = find_file(ipath);
+		if(!offset)
+			return false;
+
+		return get_file_content(offset, odata);
+	}
+
+	// Get content of many files at once, odata[i] is the content
+	// of the file at ioffsets[i].  Files are read in image order,
+	// and neighbours are merged into long sequential reads.  A file
+	// that cannot be read, or an offset of 0 for one that was not
+	// found, is left empty and false is returned
+	bool get_files_content(std::span<const std::size_t> ioffsets, std::vector<std::vector<char>> &odata) const {
+		odata.resize(ioffsets.size());
+
+		std::vector<std::size_t> order(ioffsets.size());
+
+		for(std::size_t i = 0; i < order.size(); ++i)
+			order[i] = i;
+
+		std::sort(order.begin(), order.end(),
+			[&ioffsets](std::size_t ia, std::size_t ib) -> bool { return ioffsets[ia] < ioffsets[ib]; });
+
+		bool all = true;
+		Batch batch;
+
+		for(std::size_t i : order) {
+			// Mapped images have nothing to read, going in order still helps paging
+			bool done = ioffsets[i] &&
+				(is_mapped() ? get_file_content(ioffsets[i], odata[i]) : read_batched_(batch, ioffsets[i], odata[i]));
+
+			if(!done) {
+				odata[i].clear();
+				all = false;
+			}
+		}
+
+		return all;
+	}
+
+	// Read many files at once, see get_files_content()
+	bool read(const std::vector<Path> &ipaths, std::vector<std::vector<char>> &odata) const {
+		std::vector<std::size_t> offsets(ipaths.size());
+
+		for(std::size_t i = 0; i < ipaths.size(); ++i)
+			offsets[i] = find_file(ipaths[i]);
+
+		return get_files_content(offsets, odata);
+	}
+
+	// Read many files at once by path strings, see get_files_content()
+	template<PathString S>
+	bool read(const std::vector<S> &ipaths, std::vector<std::vector<char>> &odata) const {
+		std::vector<std::size_t> offsets(ipaths.size());
+
+		for(std::size_t i = 0; i < ipaths.size(); ++i)
+			offsets[i] = find_file(ipaths[i]);
+
+		return get_files_content(offsets, odata);
+	}
+
+	// Get file content without blocking the coroutine:
+	//     std::vector<char> data = co_await grid.get_file_content_async(offset, executor);
+	// The read runs on the executor and the coroutine resumes there
+	template<Executor E>
+	Reading get_file_content_async(std::size_t ioffset, E &iexecutor) const {
+		return Reading(ioffset, [this, ioffset, &iexecutor](Async::Callback icallback) -> void {
+			iexecutor.execute([this, ioffset, icallback = std::move(icallback)](void) -> void {
+				std::vector<char> data;
+				bool read = get_file_content(ioffset, data);
+				icallback(read, std::move(data));
+			});
+		});
+	}
+
+	// Get file content through an Async, no thread blocks on the
+	// read and the coroutine resumes on the Async's thread
+	Reading get_file_content_async(std::size_t ioffset, Async &iasync) const {
+		return Reading(ioffset, [ioffset, &iasync](Async::Callback icallback) -> void {
+			iasync.read(ioffset, std::move(icallback));
+		});
+	}
+
+	// Read file without blocking the coroutine, see get_file_content_async()
+	template<Executor E>
+	Reading read_async(const Path &ipath, E &iexecutor) const { return get_file_content_async(find_file(ipath), iexecutor); }
+	Reading read_async(const Path &ipath, Async &iasync) const { return get_file_content_async(find_file(ipath), iasync); }
+
+	// Read file by path string without blocking the coroutine
+	template<PathString S, Executor E>
+	Reading read_async(const S &ipath, E &iexecutor) const { return get_file_content_async(find_file(ipath), iexecutor); }
+	template<PathString S>
+	Reading read_async(const S &ipath, Async &iasync) const { return get_file_content_async(find_file(ipath), iasync); }
+
+	// Open file content for reading piece by piece
+	bool open_file_content(std::size_t ioffset, Reader &oreader) const {
+		Header header;
+		if(!read_header_(ioffset, header))
+			return false;
+
+		oreader.open_(*this, header);
+		return true;
+	}
+
+	// Open file in directory
+	bool open(const Path &ipath, Reader &oreader, const Table &itable) const {
+		if(ipath.empty())
+			return false;
+
+		std::size_t offset = find_file(ipath, itable);
+		if(!offset)
+			return false;
+
+		return open_file_content(offset, oreader);
+	}
+
+	// Open file
+	bool open(const Path &ipath, Reader &oreader) const {
+		std::size_t offset = find_file(ipath);
+		if(!offset)
+			return false;
+
+		return open_file_content(offset, oreader);
+	}
+
+	// Open file by path string
+	template<PathString S>
+	bool open(const S &ipath, Reader &oreader) const {
+		std::size_t offset = find_file(ipath);
+		if(!offset)
+			return false;
+
+		return open_file_content(offset, oreader);
+	}
+
+private:
+
+	// Read and decode entry content into oraw, it has to be header.raw bytes
+	bool read_content_(const Header &iheader, std::span<std::byte> oraw) const {
+		// Mapped images are decoded straight out of memory
+
+		if(is_mapped()) {
+			std::span<const std::byte> stored(mapping_.data + iheader.data, iheader.stored);
+			return checked_(iheader, stored) && decode_(iheader.codec, stored, oraw);
+		}
+
+		if(iheader.codec == Codec::NONE)
+			return file_.read_at(iheader.data, oraw.data(), oraw.size()) == oraw.size() && checked_(iheader, oraw);
+
+		std::vector<std::byte> stored(iheader.stored);
+
+		if(file_.read_at(iheader.data, stored.data(), stored.size()) != stored.size())
+			return false;
+
+		return checked_(iheader, stored) && decode_(iheader.codec, stored, oraw);
+	}
+
+	// Does the stored data match the entry checksum, only checked
+	// if the grid checks reads
+	bool checked_(const Header &iheader, std::span<const std::byte> istored) const {
+		return check_ == Check::NONE || !iheader.checksummed || crc32c(istored.data(), istored.size()) == iheader.checksum;
+	}
+
+	// Read file in table
+	bool read_in_table_(std::size_t ioffset, Table& otable) const {
+		if(version_ >= 2)
+			return read_in_sorted_table_(ioffset, otable);
+
+		std::size_t table_size = 0;
+
+		// Read table size
+
+		{
+			std::uint8_t table_size_bytes[SIZE_SIZE];
+
+			if(file_.read_at(ioffset, table_size_bytes, SIZE_SIZE) != SIZE_SIZE)
+				return false;
+
+			ioffset += SIZE_SIZE;
+
+			for(std::size_t i = 0; i < SIZE_SIZE; ++i) {
+				table_size |= ((size_t)table_size_bytes[i]) << (8 * i);
+			}
+		}
+
+		otable.names.clear();
+		otable.directories.clear();
+		otable.files.clear();
+		otable.tables.clear();
+		otable.directory_slots.clear();
+		otable.file_slots.clear();
+
+		for(std::size_t i = 0; i < table_size; ++i) {
+			bool is_directory;
+
+			// Read node type
+
+			{
+				std::uint8_t c;
+
+				if(file_.read_at(ioffset, &c, 1) != 1)
+					return false;
+
+				ioffset += 1;
+
+				is_directory = (char)c == 'd';
+			}
+
+			Table::Node node = { (std::uint32_t)otable.names.size(), 0, 0 };
+
+			// Read node name into the table names
+
+			{
+				std::uint8_t read[64];
+				bool end = false;
+
+				while(!end) {
+					std::size_t rest = file_.read_at(ioffset, read, sizeof(read));
+
+					if(rest == 0)
+						return false;
+
+					for(std::size_t i = 0; i < rest; ++i) {
+						if((char)read[i] != '\0')
+							continue;
+
+						otable.names.append((char*)read, i);
+						ioffset += i + 1;
+						end = true;
+						break;
+					}
+
+					if(!end) {
+						otable.names.append((char*)read, rest);
+						ioffset += rest;
+					}
+				}
+			}
+
+			node.name_size = (std::uint32_t)(otable.names.size() - node.name_offset);
+
+			std::size_t pointing = 0;
+
+			// Read node pointer
+
+			{
+				std::uint8_t offset_bytes[SIZE_SIZE];
+
+				if(file_.read_at(ioffset, offset_bytes, SIZE_SIZE) != SIZE_SIZE)
+					return false;
+
+				ioffset += SIZE_SIZE;
+
+				for(std::size_t i = 0; i < SIZE_SIZE; ++i) {
+					pointing |= ((size_t)offset_bytes[i]) << (8 * i);
+				}
+			}
+
+			// Add a node to the table
+
+			node.target = pointing;
+
+			if(is_directory)
+				otable.directories.push_back(node);
+			else
+				otable.files.push_back(node);
+		}
+
+		otable.index_(otable.directories, otable.directory_slots);
+		otable.index_(otable.files, otable.file_slots);
+
+		// If a node is a table too, call this method,
+		// or leave it for later in the LAZY mode
+
+		otable.tables.resize(otable.directories.size());
+
+		for(std::size_t i = 0; i < otable.directories.size(); ++i) {
+			Table &nested_table = otable.tables[i];
+
+			if(lazy_) {
+				nested_table.state_ = Table::PENDING;
+				nested_table.offset_ = otable.directories[i].target;
+			} else if(!read_in_table_(otable.directories[i].target, nested_table)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// Where the parts of a versioned table are, checked to be
+	// inside the tables part of the image
+	struct TableLayout_ {
+		std::size_t directories;
+		std::size_t files;
+		// Offsets of the targets, sizes, times, restarts and names
+		std::size_t targets;
+		std::size_t sizes;
+		std::size_t times;
+		std::size_t restarts;
+		std::size_t names;
+		std::size_t names_size;
+	};
+
+	static std::size_t restart_count_(std::size_t inodes) noexcept {
+		return (inodes + format::NAME_RESTART_INTERVAL - 1) / format::NAME_RESTART_INTERVAL;
+	}
+
+	bool table_layout_(std::size_t ioffset, const std::uint8_t *ihead, TableLayout_ &olayout) const {
+		olayout.directories = load_u32_(ihead);
+		olayout.files = load_u32_(ihead + 4);
+		olayout.names_size = load_u32_(ihead + 8);
+
+		std::size_t nodes = olayout.directories + olayout.files;
+		std::size_t size = format::TABLE_HEAD_SIZE + olayout.names_size;
+
+		olayout.targets = ioffset + format::TABLE_HEAD_SIZE;
+
+		olayout.sizes = olayout.targets + nodes * format::TABLE_TARGET_SIZE;
+		olayout.times = olayout.sizes + (sizes_ ? olayout.files * format::TABLE_STAT_SIZE : 0);
+		olayout.restarts = olayout.times + (times_ ? olayout.files * format::TABLE_STAT_SIZE : 0);
+
+		std::size_t restarts = restart_count_(olayout.directories) + restart_count_(olayout.files);
+		olayout.names = olayout.restarts + restarts * 4;
+
+		size += olayout.names - olayout.targets;
+
+		return ioffset >= tables_offset_ && ioffset <= bunch_offset && bunch_offset - ioffset >= size;
+	}
+
+	// LEB128, false if it runs past iend
+	static bool load_varint_(const std::uint8_t *&ubytes, const std::uint8_t *iend, std::size_t &ovalue) noexcept {
+		ovalue = 0;
+
+		for(unsigned shift = 0; shift < 64; shift += 7) {
+			if(ubytes == iend)
+				return false;
+
+			std::uint8_t byte = *ubytes++;
+			ovalue |= (std::size_t)(byte & 0x7f) << shift;
+
+			if(!(byte & 0x80))
+				return true;
+		}
+
+		return false;
+	}
+
+	// One front coded name: the size of the prefix shared with the
+	// name before it, the size of the rest, then the rest
+	static bool load_name_(const std::uint8_t *&ubytes, const std::uint8_t *iend, std::size_t &oshared, std::string_view &osuffix) noexcept {
+		std::size_t suffix_size = 0;
+
+		if(!load_varint_(ubytes, iend, oshared) || !load_varint_(ubytes, iend, suffix_size))
+			return false;
+
+		if((std::size_t)(iend - ubytes) < suffix_size)
+			return false;
+
+		osuffix = std::string_view((const char*)ubytes, suffix_size);
+		ubytes += suffix_size;
+		return true;
+	}
+
+	// Expand icount front coded names into otable.names
+	static bool expand_names_(const std::uint8_t *ibytes, const std::uint8_t *iend, std::size_t icount, Table &otable, std::vector<Table::Node> &onodes) {
+		std::size_t previous = 0;
+
+		for(std::size_t i = 0; i < icount; ++i) {
+			std::size_t shared;
+			std::string_view suffix;
+
+			if(!load_name_(ibytes, iend, shared, suffix))
+				return false;
+
+			// Restarts have to stand alone, lookups start there
+			if(i % format::NAME_RESTART_INTERVAL == 0 ? shared != 0 : shared > onodes[i - 1].name_size)
+				return false;
+
+			std::size_t offset = otable.names.size();
+
+			if(suffix.size() > UINT32_MAX - shared || offset > UINT32_MAX - shared - suffix.size())
+				return false;
+
+			otable.names.resize(offset + shared);
+			std::memcpy(otable.names.data() + offset, otable.names.data() + previous, shared);
+			otable.names.append(suffix);
+
+			onodes[i].name_offset = (std::uint32_t)offset;
+			onodes[i].name_size = (std::uint32_t)(shared + suffix.size());
+			previous = offset;
+		}
+
+		return true;
+	}
+
+	// Read in a versioned table, front coded names are expanded
+	bool read_in_sorted_table_(std::size_t ioffset, Table &otable) const {
+		std::uint8_t head[format::TABLE_HEAD_SIZE];
+		TableLayout_ layout;
+
+		if(ioffset > bunch_offset || bunch_offset - ioffset < format::TABLE_HEAD_SIZE)
+			return false;
+
+		if(read_at_(ioffset, head, format::TABLE_HEAD_SIZE) != format::TABLE_HEAD_SIZE)
+			return false;
+
+		if(!table_layout_(ioffset, head, layout))
+			return false;
+
+		std::size_t nodes = layout.directories + layout.files;
+
+		// Everything past the head in one read
+		std::vector<std::uint8_t> body(layout.names + layout.names_size - layout.targets);
+
+		if(read_at_(layout.targets, body.data(), body.size()) != body.size())
+			return false;
+
+		otable.directories.resize(layout.directories);
+		otable.files.resize(layout.files);
+		otable.tables.clear();
+		otable.names.clear();
+
+		const std::uint8_t *restarts = body.data() + (layout.restarts - layout.targets);
+		const std::uint8_t *names = body.data() + (layout.names - layout.targets);
+		const std::uint8_t *end = names + layout.names_size;
+
+		// Files start at their first restart
+		std::size_t files_at = restart_count_(layout.directories);
+		std::size_t files_names = layout.files ? load_u32_(restarts + files_at * 4) : layout.names_size;
+
+		if(files_names > layout.names_size)
+			return false;
+
+		otable.names.reserve(layout.names_size);
+
+		if(!expand_names_(names, names + files_names, layout.directories, otable, otable.directories))
+			return false;
+
+		if(!expand_names_(names + files_names, end, layout.files, otable, otable.files))
+			return false;
+
+		for(std::size_t i = 0; i < nodes; ++i)
+			(i < layout.directories ? otable.directories[i] : otable.files[i - layout.directories]).target = load_u64_(body.data() + i * format::TABLE_TARGET_SIZE);
+
+		// Sizes and times go by the order of the files, and lookups
+		// in the mapping count on it, so it has to be sorted already
+
+		for(const std::vector<Table::Node> *nodes_of : { &otable.directories, &otable.files }) {
+			for(std::size_t i = 1; i < nodes_of->size(); ++i) {
+				if(!(otable.name((*nodes_of)[i - 1]) < otable.name((*nodes_of)[i])))
+					return false;
+			}
+		}
+
+		otable.sizes.clear();
+		otable.times.clear();
+
+		for(std::size_t i = 0; sizes_ && i < layout.files; ++i)
+			otable.sizes.push_back(load_u64_(body.data() + (layout.sizes - layout.targets) + i * format::TABLE_STAT_SIZE));
+
+		for(std::size_t i = 0; times_ && i < layout.files; ++i)
+			otable.times.push_back((std::int64_t)load_u64_(body.data() + (layout.times - layout.targets) + i * format::TABLE_STAT_SIZE));
+
+		otable.index_(otable.directories, otable.directory_slots);
+		otable.index_(otable.files, otable.file_slots);
+
+		otable.tables.resize(otable.directories.size());
+
+		for(std::size_t i = 0; i < otable.directories.size(); ++i) {
+			Table &nested_table = otable.tables[i];
+
+			if(lazy_) {
+				nested_table.state_ = Table::PENDING;
+				nested_table.offset_ = otable.directories[i].target;
+			} else if(!read_in_sorted_table_(otable.directories[i].target, nested_table)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// Scan one block of front coded names for iname, names are
+	// compared as they are decoded, the block is never expanded.
+	// Only the length of the prefix the name shares with iname is
+	// kept, a name sharing less of it with the one before is past
+	// iname already
+	static bool scan_names_(const std::uint8_t *ibytes, const std::uint8_t *iend, std::size_t icount, std::string_view iname, std::size_t &oindex) noexcept {
+		std::size_t matched = 0;
+
+		for(std::size_t i = 0; i < icount; ++i) {
+			std::size_t shared;
+			std::string_view suffix;
+
+			if(!load_name_(ibytes, iend, shared, suffix))
+				return false;
+
+			if(shared < matched)
+				return false;
+
+			if(shared > matched)
+				continue;
+
+			std::string_view rest = iname.substr(matched);
+			std::size_t common = 0;
+
+			while(common < suffix.size() && common < rest.size() && suffix[common] == rest[common])
+				++common;
+
+			if(common == suffix.size() && common == rest.size()) {
+				oindex = i;
+				return true;
+			}
+
+			// This name is past iname
+			if(common == rest.size() || (common < suffix.size() && (std::uint8_t)suffix[common] > (std::uint8_t)rest[common]))
+				return false;
+
+			matched += common;
+		}
+
+		return false;
+	}
+
+	// Find a node in a versioned table right in the mapping, the
+	// nodes are sorted, so it is a binary search without reading
+	// the table in.  Names are searched by restart, then one block
+	// is scanned
+	bool find_mapped_(std::size_t itable, std::string_view iname, bool idirectory, Entry &otarget, std::size_t &oindex) const {
+		if(itable > bunch_offset || bunch_offset - itable < format::TABLE_HEAD_SIZE)
+			return false;
+
+		const std::uint8_t *image = (const std::uint8_t*)mapping_.data;
+		TableLayout_ layout;
+
+		if(!table_layout_(itable, image + itable, layout))
+			return false;
+
+		const std::uint8_t *names = image + layout.names;
+		const std::uint8_t *end = names + layout.names_size;
+
+		std::size_t count = idirectory ? layout.directories : layout.files;
+		std::size_t first = idirectory ? 0 : layout.directories;
+		const std::uint8_t *restarts = image + layout.restarts + (idirectory ? 0 : restart_count_(layout.directories) * 4);
+
+		// Last restart not past iname
+
+		std::size_t low = 0, high = restart_count_(count);
+
+		while(low < high) {
+			std::size_t middle = low + (high - low) / 2;
+			std::uint32_t at = load_u32_(restarts + middle * 4);
+
+			if(at > layout.names_size)
+				return false;
+
+			const std::uint8_t *bytes = names + at;
+			std::size_t shared;
+			std::string_view name;
+
+			if(!load_name_(bytes, end, shared, name) || shared != 0)
+				return false;
+
+			if(name.compare(iname) <= 0)
+				low = middle + 1;
+			else
+				high = middle;
+		}
+
+		if(low == 0)
+			return false;
+
+		std::size_t block = low - 1;
+		std::uint32_t at = load_u32_(restarts + block * 4);
+		std::size_t in_block = std::min(format::NAME_RESTART_INTERVAL, count - block * format::NAME_RESTART_INTERVAL);
+		std::size_t index;
+
+		if(at > layout.names_size || !scan_names_(names + at, end, in_block, iname, index))
+			return false;
+
+		oindex = block * format::NAME_RESTART_INTERVAL + index;
+		otarget = load_u64_(image + layout.targets + (first + oindex) * format::TABLE_TARGET_SIZE);
+		return true;
+	}
+
+	// Table of a directory by the components of its path, read in
+	template<typename Components>
+	const Table* find_table_(const Components &icomponents) const {
+		const Table *actual = &table;
+
+		for(const auto &component : icomponents) {
+			if(!load(*actual))
+				return nullptr;
+
+			actual = actual->find_table(component);
+
+			if(!actual)
+				return nullptr;
+		}
+
+		return load(*actual) ? actual : nullptr;
+	}
+
+	// Where find_node_ found a node, its place in the table it is in
+	struct Found_ {
+		// Offset of the mapped table, or the table read in
+		std::size_t table_offset = 0;
+		const Table *table = nullptr;
+		// Among the directories or the files of the table
+		std::size_t index = 0;
+	};
+
+	// Find a node from the root by the components of its path,
+	// through the mapped tables of a lazy versioned image, so no
+	// table has to be read in, or a walk through the tables
+	// otherwise.  Directories target their table offset
+	template<typename Components>
+	bool find_node_(const Components &icomponents, char &otype, Entry &otarget, Found_ &ofound) const {
+		if(lazy_ && is_mapped() && version_ >= 2) {
+			std::size_t table_offset = tables_offset_;
+			std::size_t index = 0;
+			std::string_view name;
+			bool first = true;
+
+			for(const auto &component : icomponents) {
+				if(!first && !find_mapped_(table_offset, name, true, table_offset, index))
+					return false;
+
+				name = component;
+				first = false;
+			}
+
+			if(first)
+				return false;
+
+			ofound.table_offset = table_offset;
+
+			if(find_mapped_(table_offset, name, true, otarget, ofound.index)) {
+				otype = 'd';
+				return true;
+			}
+
+			if(find_mapped_(table_offset, name, false, otarget, ofound.index)) {
+				otype = 'f';
+				return true;
+			}
+
+			return false;
+		}
+
+		const Table *actual = &table;
+		std::string_view name;
+		bool first = true;
+
+		// Every component but the last one is a directory
+
+		for(const auto &component : icomponents) {
+			if(!first) {
+				if(!load(*actual))
+					return false;
+
+				actual = actual->find_table(name);
+
+				if(!actual)
+					return false;
+			}
+
+			name = component;
+			first = false;
+		}
+
+		if(first || !load(*actual))
+			return false;
+
+		ofound.table = actual;
+
+		if(const Table::Node *node = actual->find_directory(name)) {
+			otype = 'd';
+			otarget = node->target;
+			ofound.index = node - actual->directories.data();
+			return true;
+		}
+
+		if(const Table::Node *node = actual->find_file(name)) {
+			otype = 'f';
+			otarget = node->target;
+			ofound.index = node - actual->files.data();
+			return true;
+		}
+
+		return false;
+	}
+
+	// Look a path up from the root, by its components: a probe
+	// into the path index if there is one, find_node_ otherwise
+	template<typename Components>
+	bool lookup_(const Components &icomponents, char &otype, Entry &otarget) const {
+		if(is_indexed())
+			return probe_index_(icomponents, otype, otarget);
+
+		Found_ found;
+		return find_node_(icomponents, otype, otarget, found);
+	}
+
+	// Stat a path, sizes and times come from the tables, images
+	// without sizes in them have the entry header read instead
+	template<typename Components>
+	bool stat_(const Components &icomponents, Stat &ostat) const {
+		Found_ found;
+		ostat = {};
+
+		if(!find_node_(icomponents, ostat.type, ostat.target, found))
+			return false;
+
+		if(ostat.type != 'f')
+			return true;
+
+		if(!sizes_) {
+			Header header;
+
+			if(!get_file_header(ostat.target, header))
+				return false;
+
+			ostat.size = header.raw;
+			return true;
+		}
+
+		if(found.table) {
+			ostat.size = found.table->sizes[found.index];
+			ostat.mtime = times_ ? found.table->times[found.index] : 0;
+			return true;
+		}
+
+		const std::uint8_t *image = (const std::uint8_t*)mapping_.data;
+		TableLayout_ layout;
+
+		if(!table_layout_(found.table_offset, image + found.table_offset, layout))
+			return false;
+
+		ostat.size = load_u64_(image + layout.sizes + found.index * format::TABLE_STAT_SIZE);
+		ostat.mtime = times_ ? (std::int64_t)load_u64_(image + layout.times + found.index * format::TABLE_STAT_SIZE) : 0;
+		return true;
+	}
+
+	// Batched reads go forward through the image in pieces of at
+	// least BATCH_CHUNK bytes, a gap of up to BATCH_GAP bytes
+	// between entries is read through rather than skipped
+	static constexpr std::size_t BATCH_CHUNK = 1024 * 1024;
+	static constexpr std::size_t BATCH_GAP = 64 * 1024;
+
+	// Image bytes [start, start + buffer.size()) of a batched read
+	struct Batch {
+		std::size_t start = 0;
+		std::vector<std::byte> buffer;
+
+		// Image bytes [ioffset, iend), nullptr if they cannot be read.
+		// Offsets are expected to go forward
+		const std::byte* get(const Grid &igrid, std::size_t ioffset, std::size_t iend) {
+			std::size_t held_end = start + buffer.size();
+
+			if(ioffset < start || ioffset > held_end + BATCH_GAP) {
+				start = ioffset;
+				buffer.clear();
+				held_end = ioffset;
+			}
+
+			if(iend > held_end) {
+				// Drop what is behind, but keep reading from where the last read stopped
+
+				std::size_t drop = (ioffset < held_end ? ioffset : held_end) - start;
+
+				buffer.erase(buffer.begin(), buffer.begin() + drop);
+				start += drop;
+
+				std::size_t want = iend - held_end < BATCH_CHUNK ? BATCH_CHUNK : iend - held_end;
+
+				if(igrid.file_.size - held_end < want)
+					want = igrid.file_.size - held_end;
+
+				buffer.resize(buffer.size() + want);
+
+				std::size_t got = igrid.file_.read_at(held_end, buffer.data() + (held_end - start), want);
+
+				buffer.resize(held_end - start + got);
+
+				if(start + buffer.size() < iend)
+					return nullptr;
+			}
+
+			return buffer.data() + (ioffset - start);
+		}
+
+		// Forget everything, the next read starts at ioffset
+		void skip(std::size_t ioffset) {
+			start = ioffset;
+			buffer.clear();
+			return;
+		}
+	};
+
+	// Read one entry of a batch
+	bool read_batched_(Batch &ubatch, std::size_t ioffset, std::vector<char> &odata) const {
+		Header header;
+
+		// Read header, it may be cut short at the end of the image
+
+		{
+			if(ioffset >= file_.size)
+				return false;
+
+			std::size_t header_size = file_.size - ioffset < HEADER_SIZE_MAX ? file_.size - ioffset : HEADER_SIZE_MAX;
+			const std::byte *header_bytes = ubatch.get(*this, ioffset, ioffset + header_size);
+
+			if(!header_bytes || !parse_header_(ioffset, (const std::uint8_t*)header_bytes, header_size, header))
+				return false;
+		}
+
+		odata.resize(header.raw);
+		std::span<std::byte> raw((std::byte*)odata.data(), odata.size());
+
+		// A big raw entry is read straight into the output, past
+		// whatever part of it is already held
+
+		if(header.codec == Codec::NONE && header.stored > BATCH_CHUNK) {
+			std::size_t held_end = ubatch.start + ubatch.buffer.size();
+			std::size_t held = held_end > header.data ? held_end - header.data : 0;
+
+			if(held > header.stored)
+				held = header.stored;
+
+			if(held)
+				std::memcpy(raw.data(), ubatch.buffer.data() + (header.data - ubatch.start), held);
+
+			std::size_t rest = header.stored - held;
+
+			if(file_.read_at(header.data + held, raw.data() + held, rest) != rest)
+				return false;
+
+			ubatch.skip(header.data + header.stored);
+			return checked_(header, raw);
+		}
+
+		const std::byte *stored = ubatch.get(*this, header.data, header.data + header.stored);
+		if(!stored)
+			return false;
+
+		std::span<const std::byte> stored_span(stored, header.stored);
+		return checked_(header, stored_span) && decode_(header.codec, stored_span, raw);
+	}
+
+	// Read in the path index if the image has one, images
+	// without it are still read through the tables
+	void read_in_index_(void) {
+		if(file_.size < SIZE_SIZE + format::INDEX_TRAILER_SIZE)
+			return;
+
+		std::size_t index_offset = 0;
+
+		// Read trailer
+
+		{
+			std::uint8_t trailer[format::INDEX_TRAILER_SIZE];
+
+			if(file_.read_at(file_.size - format::INDEX_TRAILER_SIZE, trailer, format::INDEX_TRAILER_SIZE) != format::INDEX_TRAILER_SIZE)
+				return;
+
+			if(std::memcmp(trailer + 8, format::INDEX_MAGIC, sizeof(format::INDEX_MAGIC)) != 0)
+				return;
+
+			index_offset = load_u64_(trailer);
+		}
+
+		if(index_offset < tables_offset_ || index_offset > file_.size - format::INDEX_TRAILER_SIZE - 8)
+			return;
+
+		std::size_t index_size = file_.size - format::INDEX_TRAILER_SIZE - index_offset;
+		std::size_t slots = 0;
+
+		// Read slot count
+
+		{
+			std::uint8_t slots_bytes[8];
+
+			if(file_.read_at(index_offset, slots_bytes, 8) != 8)
+				return;
+
+			slots = load_u64_(slots_bytes);
+		}
+
+		if(slots == 0 || (slots & (slots - 1)) != 0 || slots > (index_size - 8) / format::INDEX_SLOT_SIZE)
+			return;
+
+		if(is_mapped()) {
+			index_ = std::span<const std::byte>(mapping_.data + index_offset, index_size);
+		} else if(!lazy_) {
+			index_data_.resize(index_size);
+
+			if(file_.read_at(index_offset, index_data_.data(), index_size) != index_size) {
+				index_data_.clear();
+				return;
+			}
+
+			index_ = std::span<const std::byte>(index_data_.data(), index_size);
+		}
+
+		index_offset_ = index_offset;
+		index_size_ = index_size;
+		index_slots_ = slots;
+		return;
+	}
+
+public:
+
+	Grid(const std::filesystem::path &ipath, Mode imode = Mode::STREAM, Load iload = Load::EAGER, Check icheck = Check::NONE) {
+		lazy_ = iload == Load::LAZY;
+		check_ = icheck;
+
+		if(!file_.open(ipath))
+			throw std::ios_base::failure("Unable to open file for reading");
+
+		// Failing to map is not an error, the stream is still there
+		if(imode == Mode::MAP)
+			mapping_.open(ipath);
+
+		{
+			std::size_t table_size = 0;
+			std::size_t file_size = file_.size;
+
+			std::uint8_t header[format::IMAGE_HEADER_SIZE] = {};
+			std::size_t got = file_.read_at(0, header, format::IMAGE_HEADER_SIZE);
+
+			if(got == format::IMAGE_HEADER_SIZE && std::memcmp(header, format::IMAGE_MAGIC, sizeof(format::IMAGE_MAGIC)) == 0) {
+				// Versioned header
+
+				version_ = (std::uint16_t)(header[4] | header[5] << 8);
+				std::uint16_t flags = (std::uint16_t)(header[6] | header[7] << 8);
+
+				// Only the current layout, older versioned images have
+				// to be packed again
+				if(version_ != format::IMAGE_VERSION || (flags & ~format::IMAGE_FLAGS) != 0)
+					throw std::runtime_error("Unsupported grid version");
+
+				sizes_ = (flags & format::IMAGE_FILE_SIZES) != 0;
+				times_ = (flags & format::IMAGE_FILE_TIMES) != 0;
+
+				std::uint64_t tables_size = load_u64_(header + 8);
+
+				if(tables_size > file_size - format::IMAGE_HEADER_SIZE)
+					throw std::runtime_error("File corrupted");
+
+				tables_offset_ = format::IMAGE_HEADER_SIZE;
+				table_size = (std::size_t)tables_size;
+			} else {
+				// Read all tables size
+
+				if(got < SIZE_SIZE)
+					throw std::runtime_error("File corrupted");
+
+				for(std::uint8_t i = 0; i < SIZE_SIZE; ++i) {
+					table_size |= ((size_t)header[i]) << (8 * i);
+				}
+
+				if(file_size < table_size)
+					throw std::runtime_error("File corrupted");
+			}
+
+			bunch_offset = tables_offset_ + table_size;
+
+			if(!read_in_table_(tables_offset_, table))
+				throw std::runtime_error("Grid corrupted");
+		}
+
+		read_in_index_();
+	}
+
+	Grid(const Grid &) = delete;
+	Grid& operator=(const Grid &) = delete;
+
+	// Readers, Asyncs, Caches and Walks keep a pointer to the grid,
+	// none may be open on it while it moves.  The index stays valid,
+	// the mapping and index_data_ hand their memory over as it is
+	Grid(Grid &&igrid) noexcept { *this = std::move(igrid); }
+
+	Grid& operator=(Grid &&igrid) noexcept {
+		if(this == &igrid)
+			return *this;
+
+		file_ = std::move(igrid.file_);
+		bunch_offset = igrid.bunch_offset;
+		tables_offset_ = igrid.tables_offset_;
+		version_ = igrid.version_;
+		sizes_ = igrid.sizes_;
+		times_ = igrid.times_;
+		mapping_ = std::move(igrid.mapping_);
+		lazy_ = igrid.lazy_;
+		check_ = igrid.check_;
+		index_ = igrid.index_;
+		index_data_ = std::move(igrid.index_data_);
+		index_offset_ = igrid.index_offset_;
+		index_size_ = igrid.index_size_;
+		index_slots_ = igrid.index_slots_;
+		table = std::move(igrid.table);
+
+		// Nothing left to find in the moved from grid
+		igrid.index_ = {};
+		igrid.index_data_.clear();
+		igrid.index_offset_ = 0;
+		igrid.index_size_ = 0;
+		igrid.index_slots_ = 0;
+		igrid.table = Table();
+		return *this;
+	}
+
+	~Grid(void) = default;
+};
+
+// Several grids seen as one, like a base image with patches on top.
+// A path resolves to the grid with the highest priority that has
+// it, later mounts win between equal priorities.  Directories of
+// every grid are merged, but a file hides the whole directory of a
+// lower grid with the same path.  All of them go into one merged
+// index, so a lookup is a single probe whatever the number of grids.
+// Lookups are const and can run on many threads at once, mount()
+// cannot.  Must not outlive the grids
+struct Overlay {
+	// What a path resolves to
+	struct Node {
+		// Grid the node is taken from
+		const Grid *grid;
+		// File payload offset or directory table offset in that grid
+		Grid::Entry target;
+		// 'd' or 'f'
+		char type;
+	};
+
+	struct Child {
+		std::string_view name;
+		Node node;
+	};
+
+	// Merged directory content, sorted by name.  Views into the
+	// overlay, they are good until the next mount()
+	using Directory = std::span<const Child>;
+
+	// Mount a grid, the merged index is built again, so mount
+	// everything up front.  Fails if a table of it cannot be read
+	bool mount(const Grid &igrid, int ipriority = 0) {
+		auto after = std::upper_bound(grids_.begin(), grids_.end(), ipriority,
+			[](int ipriority, const Mount &imount) -> bool { return ipriority < imount.priority; });
+
+		auto mounted = grids_.insert(after, { &igrid, ipriority });
+
+		if(build_())
+			return true;
+
+		// A table that cannot be read leaves the grid out
+		grids_.erase(mounted);
+		build_();
+		return false;
+	}
+
+	// Resolve a path into the node it stands for
+	bool resolve(const Path &ipath, Node &onode) const { return resolve_(ipath, onode); }
+
+	// Resolve a path string without allocating
+	template<PathString S>
+	bool resolve(const S &ipath, Node &onode) const { return resolve_(PathComponents{ ipath }, onode); }
+
+	// Exists in any grid
+	bool exists(const Path &ipath) const { Node node; return resolve(ipath, node); }
+
+	// Exists, by path string without allocating
+	template<PathString S>
+	bool exists(const S &ipath) const { Node node; return resolve(ipath, node); }
+
+	// Is directory
+	bool is_directory(const Path &ipath) const { Node node; return resolve(ipath, node) && node.type == 'd'; }
+
+	// Is directory, by path string without allocating
+	template<PathString S>
+	bool is_directory(const S &ipath) const { Node node; return resolve(ipath, node) && node.type == 'd'; }
+
+	// Is regular file
+	bool is_regular_file(const Path &ipath) const { Node node; return resolve(ipath, node) && node.type == 'f'; }
+
+	// Is regular file, by path string without allocating
+	template<PathString S>
+	bool is_regular_file(const S &ipath) const { Node node; return resolve(ipath, node) && node.type == 'f'; }
+
+	// Read file from the grid it resolves to
+	bool read(const Path &ipath, std::vector<char> &odata) const {
+		Node node;
+		return resolve(ipath, node) && node.type == 'f' && node.grid->get_file_content(node.target, odata);
+	}
+
+	// Read file by path string
+	template<PathString S>
+	bool read(const S &ipath, std::vector<char> &odata) const {
+		Node node;
+		return resolve(ipath, node) && node.type == 'f' && node.grid->get_file_content(node.target, odata);
+	}
+
+	// Read file into a buffer of the caller, see Grid::get_file_content()
+	bool read(const Path &ipath, std::span<std::byte> obuffer, std::size_t &owritten) const {
+		Node node;
+		owritten = 0;
+		return resolve(ipath, node) && node.type == 'f' && node.grid->get_file_content(node.target, obuffer, owritten);
+	}
+
+	// Read file by path string into a buffer of the caller
+	template<PathString S>
+	bool read(const S &ipath, std::span<std::byte> obuffer, std::size_t &owritten) const {
+		Node node;
+		owritten = 0;
+		return resolve(ipath, node) && node.type == 'f' && node.grid->get_file_content(node.target, obuffer, owritten);
+	}
+
+	// Find directory, merged from every grid that has it
+	bool find_directory(const Path &ipath, Directory &odirectory) const { return find_directory_(ipath, odirectory); }
+
+	// Find directory by path string
+	template<PathString S>
+	bool find_directory(const S &ipath, Directory &odirectory) const { return find_directory_(PathComponents{ ipath }, odirectory); }
+
+	// Merged root directory
+	Directory root(void) const { return Directory(children_.data() + root_.first_child, root_.child_count); }
+
+	// Number of mounted grids
+	std::size_t size(void) const noexcept { return grids_.size(); }
+
+	Overlay(void) = default;
+
+	Overlay(const Overlay &) = delete;
+	Overlay& operator=(const Overlay &) = delete;
+
+	~Overlay(void) = default;
+
+private:
+
+	struct Mount {
+		const Grid *grid;
+		int priority;
+	};
+
+	// A path in the merged index, a node type of 0 is an empty slot
+	struct Record {
+		std::uint64_t hash;
+		std::uint32_t path_offset;
+		std::uint32_t path_size;
+		Node node;
+		// Range of children_ of a directory
+		std::uint32_t first_child = 0;
+		std::uint32_t child_count = 0;
+	};
+
+	// Lowest priority first
+	std::vector<Mount> grids_;
+
+	// Every path, one after another, without leading separators
+	std::string paths_;
+	// Open addressing, records live right in their slots
+	std::vector<Record> slots_;
+	std::size_t records_ = 0;
+	Record root_ = {};
+	std::vector<Child> children_;
+
+	std::string_view path_(const Record &irecord) const {
+		return std::string_view(paths_.data() + irecord.path_offset, irecord.path_size);
+	}
+
+	// Find a record by path components, nullptr if there is none
+	template<typename Components>
+	const Record* find_(const Components &icomponents) const {
+		std::uint64_t hash = format::HASH_SEED;
+		bool first = true;
+
+		for(const auto &component : icomponents) {
+			if(!first)
+				hash = format::hash_name("/", hash);
+
+			hash = format::hash_name(component, hash);
+			first = false;
+		}
+
+		if(first || slots_.empty())
+			return nullptr;
+
+		std::size_t mask = slots_.size() - 1;
+
+		for(std::size_t i = hash & mask; slots_[i].node.type; i = (i + 1) & mask) {
+			const Record &record = slots_[i];
+
+			if(record.hash != hash)
+				continue;
+
+			// Compare the stored path with the components
+
+			std::string_view stored = path_(record);
+			std::size_t at = 0;
+			bool same = true;
+
+			first = true;
+
+			for(const auto &component : icomponents) {
+				if(!first) {
+					if(at >= stored.size() || stored[at] != Path::SEPARATOR) {
+						same = false;
+						break;
+					}
+
+					++at;
+				}
+
+				if(stored.substr(at, component.size()) != component) {
+					same = false;
+					break;
+				}
+
+				at += component.size();
+				first = false;
+			}
+
+			if(same && at == stored.size())
+				return &record;
+		}
+
+		return nullptr;
+	}
+
+	template<typename Components>
+	bool resolve_(const Components &icomponents, Node &onode) const {
+		const Record *record = find_(icomponents);
+		if(!record)
+			return false;
+
+		onode = record->node;
+		return true;
+	}
+
+	template<typename Components>
+	bool find_directory_(const Components &icomponents, Directory &odirectory) const {
+		const Record *record = find_(icomponents);
+		if(!record || record->node.type != 'd')
+			return false;
+
+		odirectory = Directory(children_.data() + record->first_child, record->child_count);
+		return true;
+	}
+
+	// Slot of a path, or the empty slot it would go into
+	std::size_t probe_(std::string_view ipath, std::uint64_t ihash) const {
+		std::size_t mask = slots_.size() - 1;
+		std::size_t i = ihash & mask;
+
+		while(slots_[i].node.type && (slots_[i].hash != ihash || path_(slots_[i]) != ipath))
+			i = (i + 1) & mask;
+
+		return i;
+	}
+
+	// Add every node of the table a grid has, unless a grid above
+	// already has that path.  A directory hidden by a file above is
+	// left out with everything in it
+	bool merge_table_(const Grid &igrid, const Grid::Table &itable, const std::string &iprefix) {
+		auto add = [&](const Grid::Table::Node &inode, char itype) -> const Record* {
+			std::string path = iprefix + std::string(itable.name(inode));
+			std::uint64_t hash = format::hash_name(path);
+
+			// Keep at most half of the slots taken
+			if((records_ + 1) * 2 > slots_.size()) {
+				std::vector<Record> old = std::move(slots_);
+				slots_.assign(old.empty() ? 64 : old.size() * 2, Record{});
+
+				for(const Record &taken : old) {
+					if(taken.node.type)
+						slots_[probe_(path_(taken), taken.hash)] = taken;
+				}
+			}
+
+			std::size_t slot = probe_(path, hash);
+
+			if(slots_[slot].node.type)
+				return &slots_[slot];
+
+			Record record = {};
+			record.hash = hash;
+			record.path_offset = (std::uint32_t)paths_.size();
+			record.path_size = (std::uint32_t)path.size();
+			record.node = { &igrid, inode.target, itype };
+
+			paths_ += path;
+			slots_[slot] = record;
+			++records_;
+
+			return &slots_[slot];
+		};
+
+		for(std::size_t i = 0; i < itable.directories.size(); ++i) {
+			const Record *record = add(itable.directories[i], 'd');
+
+			if(record->node.type != 'd')
+				continue;
+
+			if(!igrid.load(itable.tables[i]))
+				return false;
+
+			if(!merge_table_(igrid, itable.tables[i], std::string(path_(*record)) + Path::SEPARATOR))
+				return false;
+		}
+
+		for(const Grid::Table::Node &node : itable.files)
+			add(node, 'f');
+
+		return true;
+	}
+
+	// Build the merged index and directories from every grid
+	bool build_(void) {
+		paths_.clear();
+		slots_.clear();
+		records_ = 0;
+		children_.clear();
+		root_ = {};
+
+		// Highest priority first, so nothing has to be replaced
+
+		for(auto mount = grids_.rbegin(); mount != grids_.rend(); ++mount) {
+			if(!merge_table_(*mount->grid, mount->grid->table, "")) {
+				paths_.clear();
+				slots_.clear();
+				records_ = 0;
+				return false;
+			}
+		}
+
+		// Every record is a child of the directory its path is in
+
+		auto parent = [this](const Record &irecord) -> Record& {
+			std::string_view path = path_(irecord);
+			std::size_t separator = path.rfind(Path::SEPARATOR);
+
+			if(separator == std::string_view::npos)
+				return root_;
+
+			std::string_view parent_path = path.substr(0, separator);
+			return slots_[probe_(parent_path, format::hash_name(parent_path))];
+		};
+
+		for(const Record &record : slots_) {
+			if(record.node.type)
+				++parent(record).child_count;
+		}
+
+		{
+			std::uint32_t at = 0;
+
+			root_.first_child = at;
+			at += root_.child_count;
+
+			for(Record &record : slots_) {
+				if(!record.node.type)
+					continue;
+
+				record.first_child = at;
+				at += record.child_count;
+				record.child_count = 0;
+			}
+
+			root_.child_count = 0;
+			children_.resize(at);
+		}
+
+		for(const Record &record : slots_) {
+			if(!record.node.type)
+				continue;
+
+			Record &directory = parent(record);
+			std::string_view path = path_(record);
+			std::size_t separator = path.rfind(Path::SEPARATOR);
+
+			children_[directory.first_child + directory.child_count++] =
+				{ separator == std::string_view::npos ? path : path.substr(separator + 1), record.node };
+		}
+
+		auto sort = [this](const Record &idirectory) -> void {
+			std::sort(children_.begin() + idirectory.first_child, children_.begin() + idirectory.first_child + idirectory.child_count,
+				[](const Child &ia, const Child &ib) -> bool { return ia.name < ib.name; });
+		};
+
+		sort(root_);
+
+		for(const Record &record : slots_) {
+			if(record.node.type == 'd')
+				sort(record);
+		}
+
+		return true;
+	}
 };
 
 }
@@ -0,0 +1,103 @@
+#include "compress.hh"
+
+#include <string.h>
+
+// LZ4 block format limits
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t LAST_LITERALS = 5;
+constexpr size_t MATCH_LIMIT = 12;
+constexpr size_t MAX_OFFSET = 65535;
+
+constexpr size_t HASH_BITS = 12;
+
+static uint32_t read_u32(const uint8_t *isrc) {
+	uint32_t value;
+	memcpy(&value, isrc, sizeof(value));
+	return value;
+}
+
+static size_t hash_u32(uint32_t ivalue) {
+	return (ivalue * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Write a length that did not fit into the token
+static uint8_t* write_length(size_t ilength, uint8_t *odst) {
+	while(ilength >= 255) {
+		*odst++ = 255;
+		ilength -= 255;
+	}
+
+	*odst++ = (uint8_t)ilength;
+	return odst;
+}
+
+// Write literals and, if imatch is not zero, a match after them
+static uint8_t* write_sequence(const uint8_t *iliterals, size_t iliteral_size, size_t ioffset, size_t imatch, uint8_t *odst) {
+	uint8_t *token = odst++;
+
+	size_t match_code = imatch ? imatch - MIN_MATCH : 0;
+
+	*token = (uint8_t)((iliteral_size < 15 ? iliteral_size : 15) << 4);
+	if(iliteral_size >= 15)
+		odst = write_length(iliteral_size - 15, odst);
+
+	memcpy(odst, iliterals, iliteral_size);
+	odst += iliteral_size;
+
+	if(!imatch)
+		return odst;
+
+	*odst++ = ioffset & 0xFF;
+	*odst++ = (ioffset >> 8) & 0xFF;
+
+	*token |= (uint8_t)(match_code < 15 ? match_code : 15);
+	if(match_code >= 15)
+		odst = write_length(match_code - 15, odst);
+
+	return odst;
+}
+
+size_t compress_block(const uint8_t *isrc, size_t isize, uint8_t *odst) {
+	uint8_t *out = odst;
+	size_t anchor = 0;
+
+	if(isize > MATCH_LIMIT) {
+		// Last position a match may start at, the rest are literals
+		size_t limit = isize - MATCH_LIMIT;
+
+		int32_t table[1 << HASH_BITS];
+		memset(table, -1, sizeof(table));
+
+		size_t at = 0;
+
+		while(at < limit) {
+			uint32_t sequence = read_u32(isrc + at);
+			size_t hash = hash_u32(sequence);
+
+			int32_t candidate = table[hash];
+			table[hash] = (int32_t)at;
+
+			if(candidate < 0 || at - candidate > MAX_OFFSET || read_u32(isrc + candidate) != sequence) {
+				++at;
+				continue;
+			}
+
+			// Extend the match, it must leave the last literals alone
+
+			size_t match = MIN_MATCH;
+			size_t max_match = isize - LAST_LITERALS - at;
+
+			while(match < max_match && isrc[candidate + match] == isrc[at + match])
+				++match;
+
+			out = write_sequence(isrc + anchor, at - anchor, at - candidate, match, out);
+
+			at += match;
+			anchor = at;
+		}
+	}
+
+	out = write_sequence(isrc + anchor, isize - anchor, 0, 0, out);
+
+	return out - odst;
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Worst case size of a compressed block
+constexpr size_t compress_bound(size_t isize) { return isize + isize / 255 + 16; }
+
+// Compress one block of up to grid::format::COMPRESS_BLOCK_SIZE
+// bytes in LZ4 block format, odst must hold
+// compress_bound(isize) bytes, returns the compressed size
+size_t compress_block(const uint8_t *isrc, size_t isize, uint8_t *odst);
@@ -1,20 +1,49 @@
 #include "image.hh"
+#include "compress.hh"
+#include "output.hh"
+
+#include "grid.hh"
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <limits.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <filesystem>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 #include <string>
 
+// Layout of the image, the same one grid.hh reads
+namespace format = grid::format;
+
 struct File {
 	std::string name;
 	std::filesystem::path path;
 	size_t size;
+	// where the entry ends up in the image
+	size_t offset = 0;
+	// bytes the entry takes in the image
+	size_t stored = 0;
+	// earlier file with the same content, the entry is shared with it
+	File *original = nullptr;
+	// entry of the file in the previous image, copied as it is, 0 if
+	// the file is packed anew
+	size_t previous = 0;
+	grid::Grid::Header previous_header = {};
+	// last write time in nanoseconds since the Unix epoch, if kept
+	int64_t mtime = 0;
 };
 
 struct Directory {
@@ -23,137 +52,1034 @@ struct Directory {
 	std::vector<File> files;
 };
 
-void gather_directory(const std::filesystem::path &ipath, Directory &odir) {
-	for(const auto& entry : std::filesystem::directory_iterator(ipath)) {
-		if(std::filesystem::is_directory(entry)) {
-			Directory nested = { entry.path().filename(), {}, {} };
-			gather_directory(entry.path(), nested);
-			odir.directories.emplace_back(std::move(nested));
+// Codec byte of compressed entries
+using Codec = grid::Grid::Codec;
+
+// Options from the gridfile
+struct Options {
+	Codec codec = Codec::NONE;
+	// payload data starts on a multiple of this
+	size_t align = 1;
+	// every entry gets a CRC32C of its stored data
+	bool checksum = false;
+	// tables keep the last write time of every file
+	bool times = false;
+};
+
+// Largest payload alignment an option can ask for
+constexpr size_t ALIGN_MAX = 1024 * 1024 * 1024;
+
+// Image packed before, entries of files that did not change since
+// get copied out of it as they are
+struct Previous {
+	std::filesystem::path path;
+	std::filesystem::path root;
+	std::unique_ptr<grid::Grid> grid;
+	// when the image was written, a gridfile changed after it has
+	// every file packed again
+	std::filesystem::file_time_type time;
+	std::atomic<size_t> reused = 0;
+};
+
+// Files smaller than this are not worth compressing
+constexpr size_t COMPRESS_MIN_SIZE = 256;
+
+// Compressed entries are built in memory up to this, longer ones
+// are written out as they are compressed
+constexpr size_t ENTRY_BUFFER_SIZE = 4 * 1024 * 1024;
+
+// Path index record, path is relative to the root
+struct IndexRecord {
+	std::string path;
+	char type;
+	size_t target;
+};
+
+// Finds files that may have the same content, equal hashes still
+// get compared byte by byte
+uint64_t hash_content(const uint8_t *idata, size_t isize, uint64_t ihash) {
+	size_t at = 0;
+
+	for(; at + 8 <= isize; at += 8) {
+		uint64_t word;
+		memcpy(&word, idata + at, sizeof(word));
+
+		ihash = (ihash ^ word) * 0x9e3779b97f4a7c15ull;
+		ihash ^= ihash >> 29;
+	}
+
+	for(; at < isize; ++at) {
+		ihash = (ihash ^ idata[at]) * 0x100000001b3ull;
+	}
+
+	return ihash;
+}
+
+void put_u64(uint8_t *obytes, uint64_t ivalue) {
+	for(size_t i = 0; i < 8; ++i) {
+		obytes[i] = (ivalue >> (8 * i)) & 0xFF;
+	}
+}
+
+void put_u32(uint8_t *obytes, uint32_t ivalue) {
+	for(size_t i = 0; i < 4; ++i) {
+		obytes[i] = (ivalue >> (8 * i)) & 0xFF;
+	}
+}
+
+// Directories waiting to be gathered, shared by the gathering threads
+struct Gathering {
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::vector<std::pair<std::filesystem::path, Directory*>> queue;
+	// directories queued or being gathered right now
+	size_t pending = 0;
+	bool failed = false;
+	// gather last write times too
+	bool times = false;
+};
+
+// Gather one directory, its nested directories are queued
+bool gather_directory(const std::filesystem::path &ipath, bool itimes, Directory &odir) {
+	std::error_code error;
+
+	for(const auto& entry : std::filesystem::directory_iterator(ipath, error)) {
+		if(entry.is_directory(error)) {
+			odir.directories.push_back({ entry.path().filename().string(), {}, {} });
 			continue;
 		}
 
-		File file = { entry.path().filename(), entry.path(), entry.file_size() };
-		odir.files.emplace_back(std::move(file));
+		size_t size = entry.file_size(error);
+
+		if(error)
+			break;
+
+		odir.files.push_back({ entry.path().filename().string(), entry.path(), size });
+
+		if(itimes) {
+			auto modified = std::chrono::file_clock::to_sys(entry.last_write_time(error));
+
+			if(error)
+				break;
+
+			odir.files.back().mtime = std::chrono::duration_cast<std::chrono::nanoseconds>(modified.time_since_epoch()).count();
+		}
+	}
+
+	if(error) {
+		fprintf(stderr, "grid: unable to gather directory: %s: %s\n", ipath.c_str(), error.message().c_str());
+		return false;
 	}
+
+	// the order on disk is up to the filesystem, the image should not be
+	std::sort(odir.directories.begin(), odir.directories.end(),
+		[](const Directory &ia, const Directory &ib) -> bool { return ia.name < ib.name; });
+	std::sort(odir.files.begin(), odir.files.end(),
+		[](const File &ia, const File &ib) -> bool { return ia.name < ib.name; });
+
+	return true;
 }
 
-size_t calculate_table_size(const Directory &idir, bool recursive = false) {
-	size_t result = sizeof(size_t);
+// Take directories off the queue until there are none left anywhere
+void gather_worker(Gathering &ugathering) {
+	std::unique_lock<std::mutex> lock(ugathering.mutex);
+
+	while(true) {
+		ugathering.wake.wait(lock, [&ugathering](void) -> bool {
+			return !ugathering.queue.empty() || ugathering.pending == 0;
+		});
+
+		if(ugathering.queue.empty())
+			return;
+
+		auto [path, dir] = std::move(ugathering.queue.back());
+		ugathering.queue.pop_back();
 
-	for(const Directory &dir : idir.directories) {
-		result += 1 + dir.name.size() + 1 + sizeof(size_t);
+		lock.unlock();
+		bool gathered = gather_directory(path, ugathering.times, *dir);
+		lock.lock();
 
-		if(recursive) {
-			result += calculate_table_size(dir, recursive);
+		if(!gathered)
+			ugathering.failed = true;
+
+		// nested directories are final now, so it is safe to hand them out
+		if(!ugathering.failed) {
+			for(Directory &nested : dir->directories) {
+				ugathering.queue.emplace_back(path / nested.name, &nested);
+				++ugathering.pending;
+			}
 		}
+
+		if(--ugathering.pending == 0 || !ugathering.queue.empty())
+			ugathering.wake.notify_all();
 	}
+}
 
-	for(const File &file : idir.files) {
-		result += 1 + file.name.size() + 1 + sizeof(size_t);
+bool gather(const std::filesystem::path &ipath, bool itimes, Directory &odir, unsigned ijobs) {
+	Gathering gathering;
+	gathering.times = itimes;
+	gathering.queue.emplace_back(ipath, &odir);
+	gathering.pending = 1;
+
+	std::vector<std::thread> workers;
+	for(unsigned i = 1; i < ijobs; ++i)
+		workers.emplace_back(gather_worker, std::ref(gathering));
+
+	gather_worker(gathering);
+
+	for(std::thread &worker : workers)
+		worker.join();
+
+	return !gathering.failed;
+}
+
+size_t varint_size(size_t ivalue) {
+	size_t result = 1;
+
+	for(; ivalue >= 0x80; ivalue >>= 7)
+		++result;
+
+	return result;
+}
+
+// LEB128
+void put_varint(size_t ivalue, std::vector<uint8_t> &otables) {
+	for(; ivalue >= 0x80; ivalue >>= 7)
+		otables.push_back((uint8_t)(ivalue | 0x80));
+
+	otables.push_back((uint8_t)ivalue);
+}
+
+size_t restart_count(size_t inodes) {
+	return (inodes + format::NAME_RESTART_INTERVAL - 1) / format::NAME_RESTART_INTERVAL;
+}
+
+// Size of the prefix the name shares with the one before it
+template<typename Nodes>
+size_t shared_prefix(const Nodes &inodes, size_t iindex) {
+	if(iindex % format::NAME_RESTART_INTERVAL == 0)
+		return 0;
+
+	const std::string &before = inodes[iindex - 1].name;
+	const std::string &name = inodes[iindex].name;
+
+	size_t result = 0;
+	while(result < before.size() && result < name.size() && before[result] == name[result])
+		++result;
+
+	return result;
+}
+
+// Bytes the front coded names take
+template<typename Nodes>
+size_t names_size(const Nodes &inodes) {
+	size_t result = 0;
+
+	for(size_t i = 0; i < inodes.size(); ++i) {
+		size_t shared = shared_prefix(inodes, i);
+		size_t rest = inodes[i].name.size() - shared;
+
+		result += varint_size(shared) + varint_size(rest) + rest;
 	}
 
 	return result;
 }
 
-bool image_directory(const Directory &idir, size_t &utableoff, size_t &ubunchoff, std::ofstream &oimg) {
-	size_t this_off = utableoff;
-	utableoff += calculate_table_size(idir, false);
-	oimg.seekp(this_off, std::ios::beg);
+size_t calculate_table_size(const Directory &idir, const Options &ioptions, bool recursive = false) {
+	size_t result = format::TABLE_HEAD_SIZE;
+
+	result += (idir.directories.size() + idir.files.size()) * format::TABLE_TARGET_SIZE;
+	result += idir.files.size() * format::TABLE_STAT_SIZE * (ioptions.times ? 2 : 1);
+	result += (restart_count(idir.directories.size()) + restart_count(idir.files.size())) * 4;
+	result += names_size(idir.directories) + names_size(idir.files);
+
+	if(recursive) {
+		for(const Directory &dir : idir.directories)
+			result += calculate_table_size(dir, ioptions, recursive);
+	}
+
+	return result;
+}
+
+size_t count_files(const Directory &idir) {
+	size_t result = idir.files.size();
+
+	for(const Directory &dir : idir.directories)
+		result += count_files(dir);
+
+	return result;
+}
+
+// Files in the order their payloads go into the bunch: files of
+// nested directories first, then the directory's own
+void list_files(Directory &idir, std::vector<File*> &ofiles) {
+	for(Directory &dir : idir.directories)
+		list_files(dir, ofiles);
+
+	for(File &file : idir.files)
+		ofiles.push_back(&file);
+}
+
+// Reading buffer for hashing and comparing contents, smaller
+// files get a buffer of their own size
+constexpr size_t CONTENT_BUFFER_SIZE = 1024 * 1024;
+
+size_t content_buffer_size(const File &ifile) {
+	return ifile.size < CONTENT_BUFFER_SIZE ? ifile.size : CONTENT_BUFFER_SIZE;
+}
+
+bool hash_file(const File &ifile, uint64_t &ohash) {
+	std::ifstream in(ifile.path, std::ios::binary);
+	if(!in.is_open()) {
+		fprintf(stderr, "grid: unable to open file: %s\n", ifile.path.c_str());
+		return false;
+	}
+
+	std::vector<uint8_t> buffer(content_buffer_size(ifile));
+	uint64_t hash = 0xcbf29ce484222325ull;
+	size_t rest = ifile.size;
+
+	while(rest >= 1) {
+		size_t to_read = rest < buffer.size() ? rest : buffer.size();
+		in.read((char*)buffer.data(), to_read);
+
+		if((size_t)in.gcount() != to_read) {
+			fprintf(stderr, "grid: unable to read file: %s\n", ifile.path.c_str());
+			return false;
+		}
+
+		hash = hash_content(buffer.data(), to_read, hash);
+		rest -= to_read;
+	}
+
+	ohash = hash;
+	return true;
+}
+
+// Copy the file to ioffset of the image and checksum the very bytes
+// written, so a file changing meanwhile cannot leave a wrong checksum
+bool copy_checksummed(const File &ifile, size_t ioffset, Output &oimg, uint32_t &ocrc) {
+	std::ifstream in(ifile.path, std::ios::binary);
+	if(!in.is_open()) {
+		fprintf(stderr, "grid: unable to open file: %s\n", ifile.path.c_str());
+		return false;
+	}
+
+	std::vector<uint8_t> buffer(content_buffer_size(ifile));
+	uint32_t crc = 0;
+	size_t rest = ifile.size;
+
+	while(rest >= 1) {
+		size_t to_read = rest < buffer.size() ? rest : buffer.size();
+		in.read((char*)buffer.data(), to_read);
+
+		if((size_t)in.gcount() != to_read) {
+			fprintf(stderr, "grid: unable to read file: %s\n", ifile.path.c_str());
+			return false;
+		}
+
+		if(!oimg.write_at(ioffset, buffer.data(), to_read)) {
+			fprintf(stderr, "grid: unable to write image\n");
+			return false;
+		}
+
+		crc = grid::crc32c(buffer.data(), to_read, crc);
+		ioffset += to_read;
+		rest -= to_read;
+	}
+
+	ocrc = crc;
+	return true;
+}
+
+bool same_content(const File &ia, const File &ib, bool &osame) {
+	std::ifstream in_a(ia.path, std::ios::binary);
+	std::ifstream in_b(ib.path, std::ios::binary);
+
+	if(!in_a.is_open() || !in_b.is_open()) {
+		fprintf(stderr, "grid: unable to open file: %s\n", (in_a.is_open() ? ib : ia).path.c_str());
+		return false;
+	}
+
+	std::vector<uint8_t> buffer_a(content_buffer_size(ia)), buffer_b(content_buffer_size(ia));
+	size_t rest = ia.size;
+
+	osame = false;
+
+	while(rest >= 1) {
+		size_t to_read = rest < buffer_a.size() ? rest : buffer_a.size();
+		in_a.read((char*)buffer_a.data(), to_read);
+		in_b.read((char*)buffer_b.data(), to_read);
+
+		if((size_t)in_a.gcount() != to_read || (size_t)in_b.gcount() != to_read) {
+			fprintf(stderr, "grid: unable to read file: %s\n", ((size_t)in_a.gcount() != to_read ? ia : ib).path.c_str());
+			return false;
+		}
+
+		if(memcmp(buffer_a.data(), buffer_b.data(), to_read) != 0)
+			return true;
+
+		rest -= to_read;
+	}
+
+	osame = true;
+	return true;
+}
+
+// Point every new file at the first one in the list with the same
+// content, those go to oduplicates.  Only files sharing a size with
+// another one are read.  Files copied from the previous image keep
+// their entry and are read only if a new file has their size, so
+// an update reads none of the files it copies otherwise
+bool find_duplicates(std::vector<File*> &ufiles, unsigned ijobs, std::vector<File*> &oduplicates) {
+	std::vector<File*> candidates;
 
-	// write this table meta
 	{
-		size_t total_entries_in_table = idir.files.size() + idir.directories.size();
+		// new files and copied ones of every size
+		std::unordered_map<size_t, std::pair<size_t, size_t>> sizes;
+		for(File *file : ufiles) {
+			if(file->previous)
+				++sizes[file->size].second;
+			else if(!file->original)
+				++sizes[file->size].first;
+		}
+
+		for(File *file : ufiles) {
+			auto [fresh, copied] = sizes[file->size];
 
-		uint8_t meta_out[sizeof(size_t)];
-		for (size_t i = 0; i < sizeof(size_t); ++i) {
-			meta_out[i] = (total_entries_in_table >> (8 * i)) & 0xFF;
+			if(file->previous ? fresh >= 1 : !file->original && fresh + copied >= 2)
+				candidates.push_back(file);
 		}
+	}
+
+	std::vector<uint64_t> hashes(candidates.size());
+
+	// hash on every thread, candidates are taken one by one
+	{
+		std::atomic<size_t> next = 0;
+		std::atomic<bool> failed = false;
+
+		auto worker = [&](void) -> void {
+			while(!failed) {
+				size_t i = next++;
+				if(i >= candidates.size())
+					return;
+
+				if(!hash_file(*candidates[i], hashes[i]))
+					failed = true;
+			}
+		};
+
+		std::vector<std::thread> workers;
+		for(unsigned i = 1; i < ijobs; ++i)
+			workers.emplace_back(worker);
 
-		oimg.write((char*)meta_out, sizeof(size_t));
+		worker();
+
+		for(std::thread &thread : workers)
+			thread.join();
+
+		if(failed)
+			return false;
 	}
 
-	for(const Directory &dir : idir.directories) {
-		// write nested directory meta
-		{
-			size_t nested_table_meta_size = 1 + dir.name.size() + 1 + sizeof(size_t);
-			std::vector<uint8_t> nested_table_meta(nested_table_meta_size, 0);
+	// in list order, so the first file of every content keeps its entry
+	std::map<std::pair<size_t, uint64_t>, std::vector<File*>> originals;
 
-			nested_table_meta[0] = 'd';
-			memcpy(&nested_table_meta[1], dir.name.c_str(), dir.name.size());
+	for(size_t i = 0; i < candidates.size(); ++i) {
+		File *file = candidates[i];
+		std::vector<File*> &same_hash = originals[{ file->size, hashes[i] }];
+
+		// a copied file keeps its entry even after one of the same content
+		for(File *original : same_hash) {
+			if(file->previous)
+				break;
+
+			bool same;
+			if(!same_content(*original, *file, same))
+				return false;
 
-			for (size_t i = 0; i < sizeof(size_t); ++i) {
-				nested_table_meta[1 + dir.name.size() + 1 + i] = (utableoff >> (8 * i)) & 0xFF;
+			if(same) {
+				file->original = original;
+				oduplicates.push_back(file);
+				break;
 			}
+		}
+
+		if(!file->original)
+			same_hash.push_back(file);
+	}
+
+	return true;
+}
 
-			oimg.write((char*)nested_table_meta.data(), nested_table_meta_size);
+// Bunch space handed out to files one after another, in the list
+// order, no matter which thread finishes first
+struct Layout {
+	std::mutex mutex;
+	std::condition_variable turn;
+	// next file to take
+	size_t next = 0;
+	// files that have their offset
+	size_t placed = 0;
+	// end of the bunch so far
+	size_t cursor = 0;
+	// payload data, right after the entry header, is aligned to this
+	size_t align = 1;
+	bool failed = false;
+};
+
+// Wait for the file's turn and take the offset of its entry, iheader
+// bytes of it are the entry header, the data after it gets aligned.
+// The turn is held until end_file(), the entry may be written before
+bool begin_file(Layout &ulayout, size_t iindex, size_t iheader, size_t &ooffset) {
+	std::unique_lock<std::mutex> lock(ulayout.mutex);
+
+	ulayout.turn.wait(lock, [&ulayout, iindex](void) -> bool {
+		return ulayout.placed == iindex || ulayout.failed;
+	});
+
+	if(ulayout.failed)
+		return false;
+
+	// the gap before an aligned entry is left a hole
+	size_t data = (ulayout.cursor + iheader + ulayout.align - 1) & ~(ulayout.align - 1);
+
+	ooffset = data - iheader;
+	return true;
+}
+
+// Give up the turn, the entry at ioffset takes isize bytes of the bunch
+void end_file(Layout &ulayout, size_t ioffset, size_t isize) {
+	std::lock_guard<std::mutex> lock(ulayout.mutex);
+
+	ulayout.cursor = ioffset + isize;
+	++ulayout.placed;
+
+	ulayout.turn.notify_all();
+}
+
+// Wait for the file's turn and take isize bytes of the bunch for it
+bool place_file(Layout &ulayout, size_t iindex, size_t iheader, size_t isize, size_t &ooffset) {
+	if(!begin_file(ulayout, iindex, iheader, ooffset))
+		return false;
+
+	end_file(ulayout, ooffset, isize);
+	return true;
+}
+
+// Wait for the file's turn and take the offset of its original, which
+// comes earlier in the list and so has it already
+bool share_file(Layout &ulayout, size_t iindex, File &ufile) {
+	std::unique_lock<std::mutex> lock(ulayout.mutex);
+
+	ulayout.turn.wait(lock, [&ulayout, iindex](void) -> bool {
+		return ulayout.placed == iindex || ulayout.failed;
+	});
+
+	if(ulayout.failed)
+		return false;
+
+	ufile.offset = ufile.original->offset;
+	++ulayout.placed;
+
+	ulayout.turn.notify_all();
+	return true;
+}
+
+void fail_layout(Layout &ulayout) {
+	std::lock_guard<std::mutex> lock(ulayout.mutex);
+	ulayout.failed = true;
+	ulayout.turn.notify_all();
+}
+
+// Find the file's entry in the previous image, if it is still the
+// same as the one that would be packed now
+bool find_previous(const File &ifile, bool icompressed, bool ichecksum, const Previous &iprevious, size_t &ooffset, grid::Grid::Header &oheader) {
+	std::string path = ifile.path.lexically_relative(iprevious.root).generic_string();
+	grid::Grid::Stat stat;
+
+	// the last write time has to be the very one packed, an older
+	// one is no proof, files can be backdated or restored
+	if(!iprevious.grid->stat(path, stat) || stat.type != 'f' || stat.size != ifile.size || stat.mtime != ifile.mtime)
+		return false;
+
+	ooffset = stat.target;
+	if(!iprevious.grid->get_file_header(ooffset, oheader))
+		return false;
+
+	return oheader.raw == ifile.size && (oheader.codec != grid::Grid::Codec::NONE) == icompressed
+		&& oheader.checksummed == ichecksum;
+}
+
+bool is_compressed(const File &ifile, const Options &ioptions) {
+	return ioptions.codec != Codec::NONE && ifile.size >= COMPRESS_MIN_SIZE;
+}
+
+// Find the entries of unchanged files in the previous image, files
+// that had one entry there share it again
+void find_reused(std::vector<File*> &ufiles, const Options &ioptions, Previous &uprevious) {
+	std::unordered_map<size_t, File*> firsts;
+
+	for(File *file : ufiles) {
+		if(!find_previous(*file, is_compressed(*file, ioptions), ioptions.checksum, uprevious, file->previous, file->previous_header)) {
+			file->previous = 0;
+			continue;
 		}
 
-		size_t was_here = oimg.tellp();
-		image_directory(dir, utableoff, ubunchoff, oimg);
-		oimg.seekp(was_here, std::ios::beg);
+		++uprevious.reused;
+		auto [first, added] = firsts.emplace(file->previous, file);
+
+		if(!added) {
+			file->original = first->second;
+			file->previous = 0;
+		}
 	}
+}
 
-	for(const File &file : idir.files) {
-		// write file meta
-		{
-			size_t file_meta_size = 1 + file.name.size() + 1 + sizeof(size_t);
-			std::vector<uint8_t> file_meta(file_meta_size, 0);
+// Write a file entry into the bunch, the offset is taken once the
+// entry size is known, or once a long compressed entry outgrows
+// its buffer
+bool image_file(File &ufile, size_t iindex, const Options &ioptions, Previous *uprevious, Layout &ulayout, Output &oimg) {
+	bool compressed = is_compressed(ufile, ioptions);
+
+	// nothing to write, the entry of the same content is shared
+	if(ufile.original)
+		return share_file(ulayout, iindex, ufile);
+
+	// copy the whole entry from the previous image, header and all
+	if(uprevious && ufile.previous) {
+		size_t offset = ufile.previous;
+		const grid::Grid::Header &header = ufile.previous_header;
+		size_t entry_size = header.data + header.stored - offset;
 
-			file_meta[0] = 'f';
-			memcpy(&file_meta[1], file.name.c_str(), file.name.size());
+		if(!place_file(ulayout, iindex, header.data - offset, entry_size, ufile.offset))
+			return false;
+
+		if(!oimg.copy_at(ufile.offset, uprevious->path, offset, entry_size)) {
+			fprintf(stderr, "grid: unable to copy entry of: %s\n", ufile.path.c_str());
+			return false;
+		}
+
+		ufile.stored = entry_size;
+		return true;
+	}
 
-			for (size_t i = 0; i < sizeof(size_t); ++i) {
-				file_meta[1 + file.name.size() + 1 + i] = (ubunchoff >> (8 * i)) & 0xFF;
+	size_t checksum_size = ioptions.checksum ? 4 : 0;
+
+	// copy file, its size is known up front, the checksum is of the
+	// copy and goes in the header after it
+	if(!compressed) {
+		uint8_t header_out[format::ENTRY_SIZE_SIZE + 4];
+		size_t header_size = format::ENTRY_SIZE_SIZE + checksum_size;
+
+		put_u64(header_out, (uint64_t)ufile.size | (ioptions.checksum ? format::ENTRY_CHECKSUM : 0));
+
+		if(!place_file(ulayout, iindex, header_size, header_size + ufile.size, ufile.offset))
+			return false;
+
+		if(ioptions.checksum) {
+			uint32_t crc;
+			if(!copy_checksummed(ufile, ufile.offset + header_size, oimg, crc))
+				return false;
+
+			put_u32(header_out + format::ENTRY_SIZE_SIZE, crc);
+		} else if(!oimg.copy_at(ufile.offset + header_size, ufile.path, 0, ufile.size)) {
+			fprintf(stderr, "grid: unable to copy file: %s\n", ufile.path.c_str());
+			return false;
+		}
+
+		if(!oimg.write_at(ufile.offset, header_out, header_size)) {
+			fprintf(stderr, "grid: unable to write image\n");
+			return false;
+		}
+
+		ufile.stored = header_size + ufile.size;
+		return true;
+	}
+
+	// compress file block by block, blocks that do not shrink are stored raw
+	std::ifstream this_file(ufile.path, std::ios::binary);
+	if(!this_file.is_open()) {
+		fprintf(stderr, "grid: unable to open file: %s\n", ufile.path.c_str());
+		return false;
+	}
+
+	// the header is filled in once the stored size is known, an entry
+	// that outgrows the buffer takes its turn and goes out as it grows
+	size_t header_size = format::ENTRY_SIZE_SIZE + checksum_size + 1 + 8;
+	std::vector<uint8_t> entry(header_size);
+	size_t stored = 0, written = 0;
+	uint32_t crc = 0;
+	bool streaming = false;
+
+	{
+		std::vector<uint8_t> read_buffer(format::COMPRESS_BLOCK_SIZE);
+		std::vector<uint8_t> block(compress_bound(format::COMPRESS_BLOCK_SIZE));
+
+		size_t rest = ufile.size;
+
+		while(rest >= 1) {
+			size_t to_read = rest < format::COMPRESS_BLOCK_SIZE ? rest : format::COMPRESS_BLOCK_SIZE;
+			this_file.read((char*)read_buffer.data(), to_read);
+
+			if((size_t)this_file.gcount() != to_read) {
+				fprintf(stderr, "grid: unable to read file: %s\n", ufile.path.c_str());
+				return false;
+			}
+
+			size_t block_size = compress_block(read_buffer.data(), to_read, block.data());
+			uint32_t block_header = (uint32_t)block_size;
+			const uint8_t *block_data = block.data();
+
+			if(block_size >= to_read) {
+				block_header = (uint32_t)to_read | format::BLOCK_RAW;
+				block_size = to_read;
+				block_data = read_buffer.data();
 			}
 
-			oimg.write((char*)file_meta.data(), file_meta_size);
+			size_t at = entry.size();
+
+			for (size_t i = 0; i < 4; ++i) {
+				entry.push_back((block_header >> (8 * i)) & 0xFF);
+			}
+
+			entry.insert(entry.end(), block_data, block_data + block_size);
+			rest -= to_read;
+
+			if(ioptions.checksum)
+				crc = grid::crc32c(&entry[at], entry.size() - at, crc);
+
+			stored += entry.size() - at;
+
+			if(entry.size() < ENTRY_BUFFER_SIZE)
+				continue;
+
+			if(!streaming && !begin_file(ulayout, iindex, header_size, ufile.offset))
+				return false;
+
+			streaming = true;
+
+			if(!oimg.write_at(ufile.offset + written, entry.data(), entry.size())) {
+				fprintf(stderr, "grid: unable to write image\n");
+				return false;
+			}
+
+			written += entry.size();
+			entry.clear();
 		}
+	}
 
-		// write file
-		size_t was_here = oimg.tellp();
-		oimg.seekp(ubunchoff, std::ios::beg);
+	uint8_t header[format::ENTRY_SIZE_SIZE + 4 + 1 + 8];
+
+	{
+		size_t at = format::ENTRY_SIZE_SIZE;
+
+		put_u64(header, (uint64_t)stored | format::ENTRY_COMPRESSED | (ioptions.checksum ? format::ENTRY_CHECKSUM : 0));
+
+		if(ioptions.checksum) {
+			put_u32(&header[at], crc);
+			at += 4;
+		}
+
+		header[at] = (uint8_t)ioptions.codec;
+		put_u64(&header[at + 1], ufile.size);
+	}
+
+	if(!streaming) {
+		memcpy(entry.data(), header, header_size);
+
+		if(!place_file(ulayout, iindex, header_size, entry.size(), ufile.offset))
+			return false;
+
+		if(!oimg.write_at(ufile.offset, entry.data(), entry.size())) {
+			fprintf(stderr, "grid: unable to write image\n");
+			return false;
+		}
+	} else {
+		if(!oimg.write_at(ufile.offset + written, entry.data(), entry.size()) || !oimg.write_at(ufile.offset, header, header_size)) {
+			fprintf(stderr, "grid: unable to write image\n");
+			return false;
+		}
+
+		end_file(ulayout, ufile.offset, header_size + stored);
+	}
+
+	ufile.stored = header_size + stored;
+	return true;
+}
+
+// Take files off the list until there are none left
+void image_worker(std::vector<File*> &ufiles, const Options &ioptions, Previous *uprevious, Layout &ulayout, Output &oimg) {
+	while(true) {
+		size_t index;
 
 		{
-			// write size
-			{
-				uint8_t size_out[sizeof(size_t)];
-				for (size_t i = 0; i < sizeof(size_t); ++i) {
-					size_out[i] = (file.size >> (8 * i)) & 0xFF;
-				}
-
-				oimg.write((char*)size_out, sizeof(size_t));
-			}
+			std::lock_guard<std::mutex> lock(ulayout.mutex);
 
-			// copy file
-			{
-				std::ifstream this_file(file.path);
-				if(!this_file.is_open()) {
-					fprintf(stderr, "grid: unable to open file: %s\n", file.path.c_str());
-					return false;
-				}
+			if(ulayout.failed || ulayout.next >= ufiles.size())
+				return;
 
-				constexpr size_t BUFFSZ = 4096;
+			index = ulayout.next++;
+		}
 
-				uint8_t read_buffer[BUFFSZ];
-				size_t rest = file.size;
+		if(!image_file(*ufiles[index], index, ioptions, uprevious, ulayout, oimg)) {
+			fail_layout(ulayout);
+			return;
+		}
+	}
+}
 
-				while(rest >= 1) {
-					size_t to_read = rest < BUFFSZ ? rest : BUFFSZ;
-					this_file.read((char*)read_buffer, to_read);
-					oimg.write((char*)read_buffer, to_read);
-					rest -= to_read;
-				}
+// Write every payload starting at ubunchoff, ubunchoff ends up past the last one
+bool image_files(Directory &uroot, const Options &ioptions, Previous *uprevious, unsigned ijobs, size_t &ubunchoff, Output &oimg) {
+	std::vector<File*> files;
+	list_files(uroot, files);
+
+	if(uprevious)
+		find_reused(files, ioptions, *uprevious);
+
+	std::vector<File*> duplicates;
+
+	if(!find_duplicates(files, ijobs, duplicates)) {
+		fprintf(stderr, "grid: unable to find duplicate files\n");
+		return false;
+	}
+
+	Layout layout;
+	layout.cursor = ubunchoff;
+	layout.align = ioptions.align;
+
+	std::vector<std::thread> workers;
+	for(unsigned i = 1; i < ijobs; ++i)
+		workers.emplace_back(image_worker, std::ref(files), std::cref(ioptions), uprevious, std::ref(layout), std::ref(oimg));
+
+	image_worker(files, ioptions, uprevious, layout, oimg);
+
+	for(std::thread &worker : workers)
+		worker.join();
+
+	if(layout.failed)
+		return false;
+
+	// report what sharing entries of the same content saved, files
+	// sharing an entry of the previous image are counted as reused
+	{
+		size_t saved = 0;
+
+		for(const File *file : duplicates)
+			saved += file->original->stored;
+
+		if(!duplicates.empty())
+			fprintf(stdout, "grid: %zu duplicate files share an entry, %zu bytes saved\n", duplicates.size(), saved);
+	}
+
+	ubunchoff = layout.cursor;
+	return true;
+}
+
+// Front code the names at the end of the tables, the offset of every
+// restart from inames goes at urestart
+template<typename Nodes>
+void put_names(const Nodes &inodes, size_t inames, size_t &urestart, std::vector<uint8_t> &otables) {
+	for(size_t i = 0; i < inodes.size(); ++i) {
+		if(i % format::NAME_RESTART_INTERVAL == 0) {
+			put_u32(&otables[urestart], (uint32_t)(otables.size() - inames));
+			urestart += 4;
+		}
+
+		const std::string &name = inodes[i].name;
+		size_t shared = shared_prefix(inodes, i);
+
+		put_varint(shared, otables);
+		put_varint(name.size() - shared, otables);
+		otables.insert(otables.end(), name.begin() + shared, name.end());
+	}
+}
+
+// Write this directory table and every nested one, utableoff is
+// where the next table goes, payload offsets have to be known
+void image_directory(const Directory &idir, const std::string &iprefix, const Options &ioptions, size_t &utableoff, std::vector<IndexRecord> &uindex, std::vector<uint8_t> &otables) {
+	size_t this_off = utableoff;
+	utableoff += calculate_table_size(idir, ioptions, false);
+
+	// tables are laid out one after another in the order they
+	// are written, otables starts at the very beginning of the image
+	otables.resize(this_off);
+
+	// write this table head, targets, sizes, times and restarts are
+	// filled in below and the names follow them.  Nodes are gathered
+	// sorted by name, so grid can binary search them in place
+	size_t targets_off = this_off + format::TABLE_HEAD_SIZE;
+	size_t sizes_off = targets_off + (idir.directories.size() + idir.files.size()) * format::TABLE_TARGET_SIZE;
+	size_t times_off = sizes_off + idir.files.size() * format::TABLE_STAT_SIZE;
+	size_t restarts_off = times_off + (ioptions.times ? idir.files.size() * format::TABLE_STAT_SIZE : 0);
+	size_t names_off = restarts_off + (restart_count(idir.directories.size()) + restart_count(idir.files.size())) * 4;
+
+	otables.resize(names_off);
+	put_u32(&otables[this_off], (uint32_t)idir.directories.size());
+	put_u32(&otables[this_off + 4], (uint32_t)idir.files.size());
+	put_u32(&otables[this_off + 8], (uint32_t)(names_size(idir.directories) + names_size(idir.files)));
+
+	std::vector<size_t> nested_offsets;
+
+	// nested tables go where they would if written one by one
+	{
+		size_t nested_off = utableoff;
+
+		for(const Directory &dir : idir.directories) {
+			nested_offsets.push_back(nested_off);
+			nested_off += calculate_table_size(dir, ioptions, true);
+		}
+	}
+
+	for(size_t i = 0; i < idir.directories.size(); ++i) {
+		const Directory &dir = idir.directories[i];
+
+		put_u64(&otables[targets_off], nested_offsets[i]);
+		uindex.push_back({ iprefix + dir.name, 'd', nested_offsets[i] });
+		targets_off += format::TABLE_TARGET_SIZE;
+	}
+
+	for(const File &file : idir.files) {
+		put_u64(&otables[targets_off], file.offset);
+		uindex.push_back({ iprefix + file.name, 'f', file.offset });
+		targets_off += format::TABLE_TARGET_SIZE;
+
+		put_u64(&otables[sizes_off], file.size);
+		sizes_off += format::TABLE_STAT_SIZE;
+
+		if(ioptions.times) {
+			put_u64(&otables[times_off], (uint64_t)file.mtime);
+			times_off += format::TABLE_STAT_SIZE;
+		}
+	}
+
+	put_names(idir.directories, names_off, restarts_off, otables);
+	put_names(idir.files, names_off, restarts_off, otables);
+
+	for(const Directory &dir : idir.directories)
+		image_directory(dir, iprefix + dir.name + "/", ioptions, utableoff, uindex, otables);
+}
+
+// Write the path index at iindexoff, the end of the bunch
+bool image_index(const std::vector<IndexRecord> &iindex, size_t iindexoff, Output &oimg) {
+	size_t slot_count = 2;
+	while(slot_count < iindex.size() * 2)
+		slot_count *= 2;
+
+	std::vector<uint8_t> out(8 + slot_count * format::INDEX_SLOT_SIZE, 0);
+	put_u64(&out[0], slot_count);
+
+	std::string paths;
+
+	// fill the slots, linear probing
+	{
+		uint8_t *slots = &out[8];
+		size_t mask = slot_count - 1;
+
+		for(const IndexRecord &record : iindex) {
+			uint64_t hash = format::hash_name(record.path);
+			size_t i = hash & mask;
+
+			while(slots[i * format::INDEX_SLOT_SIZE + 28] != 0)
+				i = (i + 1) & mask;
+
+			uint8_t *slot = &slots[i * format::INDEX_SLOT_SIZE];
+			put_u64(slot, hash);
+			put_u64(slot + 8, record.target);
+			put_u64(slot + 16, paths.size());
+
+			for(size_t b = 0; b < 4; ++b) {
+				slot[24 + b] = (record.path.size() >> (8 * b)) & 0xFF;
 			}
+
+			slot[28] = record.type;
+
+			paths += record.path;
 		}
+	}
 
-		ubunchoff += sizeof(size_t) + file.size;
-		oimg.seekp(was_here, std::ios::beg);
+	out.insert(out.end(), paths.begin(), paths.end());
+
+	// trailer
+	{
+		size_t at = out.size();
+		out.resize(at + 8);
+		put_u64(&out[at], iindexoff);
+		out.insert(out.end(), format::INDEX_MAGIC, format::INDEX_MAGIC + sizeof(format::INDEX_MAGIC));
+	}
+
+	if(!oimg.write_at(iindexoff, out.data(), out.size())) {
+		fprintf(stderr, "grid: unable to write path index\n");
+		return false;
 	}
 
 	return true;
 }
 
-bool read_gridfile(const std::filesystem::path &ipath, std::filesystem::path &oroot, std::filesystem::path &oimg)
+// Option lines look like 'name value'
+bool read_option(const std::filesystem::path &ipath, const std::string &iline, Options &uoptions) {
+	size_t space = iline.find(' ');
+	std::string name = iline.substr(0, space);
+	std::string value = space == std::string::npos ? "" : iline.substr(space + 1);
+
+	if(name == "compress") {
+		if(value == "none")
+			uoptions.codec = Codec::NONE;
+		else if(value == "lz4")
+			uoptions.codec = Codec::LZ4;
+		else {
+			fprintf(stderr, "grid: gridfile is invalid: %s: unknown codec: %s\n", ipath.c_str(), value.c_str());
+			return false;
+		}
+
+		return true;
+	}
+
+	if(name == "checksum") {
+		if(value == "none")
+			uoptions.checksum = false;
+		else if(value == "crc32c")
+			uoptions.checksum = true;
+		else {
+			fprintf(stderr, "grid: gridfile is invalid: %s: unknown checksum: %s\n", ipath.c_str(), value.c_str());
+			return false;
+		}
+
+		return true;
+	}
+
+	if(name == "mtime") {
+		if(value == "none")
+			uoptions.times = false;
+		else if(value == "keep")
+			uoptions.times = true;
+		else {
+			fprintf(stderr, "grid: gridfile is invalid: %s: unknown mtime: %s\n", ipath.c_str(), value.c_str());
+			return false;
+		}
+
+		return true;
+	}
+
+	if(name == "align") {
+		char *end = nullptr;
+		unsigned long long align = strtoull(value.c_str(), &end, 10);
+
+		if(value.empty() || *end != '\0' || align == 0 || align > ALIGN_MAX || (align & (align - 1)) != 0) {
+			fprintf(stderr, "grid: gridfile is invalid: %s: alignment is not a power of two up to 1 GiB: %s\n", ipath.c_str(), value.c_str());
+			return false;
+		}
+
+		uoptions.align = (size_t)align;
+		return true;
+	}
+
+	fprintf(stderr, "grid: gridfile is invalid: %s: unknown option: %s\n", ipath.c_str(), name.c_str());
+	return false;
+}
+
+bool read_gridfile(const std::filesystem::path &ipath, std::filesystem::path &oroot, std::filesystem::path &oimg, Options &ooptions)
 {
 	std::ifstream gridfile(ipath);
 	if(!gridfile) {
@@ -168,9 +1094,15 @@ bool read_gridfile(const std::filesystem::path &ipath, std::filesystem::path &or
 		uint8_t lnp = 0;
 
 		while(std::getline(gridfile, tmpln)) {
+			// every line after the first two is an option
 			if(lnp >= 2) {
-				fprintf(stderr, "grid: gridfile is invalid: %s: too many lines\n", ipath.c_str());
-				return false;
+				if(tmpln.empty())
+					continue;
+
+				if(!read_option(ipath, tmpln, ooptions))
+					return false;
+
+				continue;
 			}
 
 			ln[lnp++] = tmpln;
@@ -188,11 +1120,87 @@ bool read_gridfile(const std::filesystem::path &ipath, std::filesystem::path &or
 	return true;
 }
 
-bool image(const std::filesystem::path &igridfile) {
+// Payloads, tables and the path index of the whole image
+bool write_image(Directory &uroot, size_t itable_size, const Options &ioptions, Previous *uprevious, unsigned ijobs, Output &oimg) {
+	size_t file_offset = format::IMAGE_HEADER_SIZE + itable_size;
+
+	// payloads first, tables need their offsets
+	if(!image_files(uroot, ioptions, uprevious, ijobs, file_offset, oimg)) { return false; }
+
+	std::vector<uint8_t> tables;
+	std::vector<IndexRecord> index;
+
+	// write image header and tables
+	{
+		size_t table_offset = format::IMAGE_HEADER_SIZE;
+
+		tables.resize(format::IMAGE_HEADER_SIZE);
+		memcpy(&tables[0], format::IMAGE_MAGIC, sizeof(format::IMAGE_MAGIC));
+		tables[4] = (uint8_t)format::IMAGE_VERSION;
+		tables[5] = (uint8_t)(format::IMAGE_VERSION >> 8);
+		uint16_t flags = format::IMAGE_FILE_SIZES | (ioptions.times ? format::IMAGE_FILE_TIMES : 0);
+
+		tables[6] = (uint8_t)flags;
+		tables[7] = (uint8_t)(flags >> 8);
+		put_u64(&tables[8], itable_size);
+
+		image_directory(uroot, "", ioptions, table_offset, index, tables);
+
+		if(!oimg.write_at(0, tables.data(), tables.size())) {
+			fprintf(stderr, "grid: unable to write tables\n");
+			return false;
+		}
+	}
+
+	return image_index(index, file_offset, oimg);
+}
+
+// Open the image packed before, unless the gridfile changed since
+bool open_previous(const std::filesystem::path &igridfile, const std::filesystem::path &iroot, const std::filesystem::path &iimg, const Options &ioptions, Previous &oprevious) {
+	std::error_code error;
+
+	// files are told unchanged by the last write time kept for them
+	if(!ioptions.times) {
+		fprintf(stdout, "grid: updating needs 'mtime keep' in the gridfile, packing every file\n");
+		return false;
+	}
+
+	oprevious.time = std::filesystem::last_write_time(iimg, error);
+	if(error)
+		return false;
+
+	// options may have changed how every entry looks
+	if(std::filesystem::last_write_time(igridfile, error) >= oprevious.time || error) {
+		fprintf(stdout, "grid: gridfile changed since the image was packed, packing every file\n");
+		return false;
+	}
+
+	try {
+		oprevious.grid = std::make_unique<grid::Grid>(iimg);
+	} catch(const std::exception &e) {
+		fprintf(stderr, "grid: unable to read previous image, packing every file: %s: %s\n", iimg.c_str(), e.what());
+		return false;
+	}
+
+	if(!oprevious.grid->has_times()) {
+		fprintf(stdout, "grid: previous image keeps no file times, packing every file\n");
+		return false;
+	}
+
+	oprevious.path = iimg;
+	oprevious.root = iroot;
+	return true;
+}
+
+bool image(const std::filesystem::path &igridfile, unsigned ijobs, bool iupdate) {
 	std::filesystem::path root_path, img_path;
+	Options options;
+
+	if(ijobs == 0)
+		ijobs = 1;
 
 	// read gridfile
-	if(!read_gridfile(igridfile, root_path, img_path)) {
+	if(!read_gridfile(igridfile, root_path, img_path, options)) {
 		fprintf(stderr, "grid: failed on reading gridfile: %s\n", igridfile.c_str());
 		return false;
 	}
@@ -205,48 +1213,69 @@ bool image(const std::filesystem::path &igridfile) {
 
 	// collecting files
 	Directory root = { "", {}, {} };
-	gather_directory(root_path, root);
+	if(!gather(root_path, options.times, root, ijobs)) {
+		fprintf(stderr, "grid: unable to gather root: %s\n", root_path.c_str());
+		return false;
+	}
 
-	size_t table_size = calculate_table_size(root, true);
+	size_t table_size = calculate_table_size(root, options, true);
 
 	// writing
 
-	if(std::filesystem::exists(img_path)) {
-		if(std::filesystem::is_regular_file(img_path)) {
-			if(!std::filesystem::remove(img_path)) {
-				fprintf(stderr, "grid: unable to delete file: %s\n", img_path.c_str());
-				return false;
-			}
-		} else {
-			fprintf(stderr, "grid: weird out path: %s\n", img_path.c_str());
+	if(std::filesystem::exists(img_path) && !std::filesystem::is_regular_file(img_path)) {
+		fprintf(stderr, "grid: weird out path: %s\n", img_path.c_str());
+		return false;
+	}
+
+	// an update is written next to the previous image and takes its
+	// place only once it is complete
+	Previous previous;
+	bool updating = iupdate && std::filesystem::exists(img_path) && open_previous(igridfile, root_path, img_path, options, previous);
+
+	std::filesystem::path out_path = img_path;
+	if(updating)
+		out_path += ".new";
+
+	if(std::filesystem::exists(out_path)) {
+		if(!std::filesystem::is_regular_file(out_path) || !std::filesystem::remove(out_path)) {
+			fprintf(stderr, "grid: unable to delete file: %s\n", out_path.c_str());
 			return false;
 		}
 	}
 
-	std::ofstream out_img(img_path, std::ios::binary);
-	if(!out_img.is_open()) {
-		fprintf(stderr, "grid: unable to open file for writing: %s\n", img_path.c_str());
+	Output out_img;
+	if(!out_img.open(out_path)) {
+		fprintf(stderr, "grid: unable to open file for writing: %s\n", out_path.c_str());
 		return false;
 	}
 
-	// write header size
-	{
-		uint8_t size_out[sizeof(size_t)];
+	bool written = write_image(root, table_size, options, updating ? &previous : nullptr, ijobs, out_img);
 
-		for (size_t i = 0; i < sizeof(size_t); ++i) {
-			size_out[i] = (table_size >> (8 * i)) & 0xFF;
-		}
-
-		out_img.write((char*)size_out, sizeof(size_t));
+	if(written && !out_img.close()) {
+		fprintf(stderr, "grid: unable to write image: %s\n", out_path.c_str());
+		written = false;
 	}
 
-	// image
-	{
-		size_t table_offset = sizeof(size_t);
-		size_t file_offset = sizeof(size_t) + table_size;
+	if(!updating)
+		return written;
 
-		if(!image_directory(root, table_offset, file_offset, out_img)) { return false; }
+	previous.grid.reset();
+
+	std::error_code error;
+
+	if(!written) {
+		out_img.close();
+		std::filesystem::remove(out_path, error);
+		return false;
+	}
+
+	std::filesystem::rename(out_path, img_path, error);
+	if(error) {
+		fprintf(stderr, "grid: unable to replace image: %s: %s\n", img_path.c_str(), error.message().c_str());
+		std::filesystem::remove(out_path, error);
+		return false;
 	}
 
+	fprintf(stdout, "grid: %zu of %zu files reused\n", previous.reused.load(), count_files(root));
 	return true;
 }
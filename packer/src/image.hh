@@ -1,5 +1,6 @@
 #pragma once
 #include <filesystem>
 
-bool image(const std::filesystem::path& igridfile);
+// Pack the gridfile root into its image on ijobs threads
+bool image(const std::filesystem::path& igridfile, unsigned ijobs = 1, bool iupdate = false);
 
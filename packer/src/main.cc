@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <filesystem>
 
@@ -8,7 +9,11 @@
 void print_usage(void) {
 	fprintf(stderr,
 R"(grid: usage:
-	grid ./.gridfile/
+	grid [-j N] [-u] ./.gridfile/
+
+	-j N	pack on N threads, 1 by default
+	-u	update the image, files that did not change since
+		it was packed are copied out of it
 )"); return;
 }
 
@@ -16,25 +21,72 @@ void print_not_implemented(void) {
 	fprintf(stderr, "grid: mode is not implemented\n"); return;
 }
 
+// Jobs look like '-j N' or '-jN'
+bool read_jobs(int iargc, char **iargv, int &uarg, unsigned &ojobs) {
+	const char *value = iargv[uarg] + 2;
+
+	if(*value == '\0') {
+		if(++uarg >= iargc)
+			return false;
+
+		value = iargv[uarg];
+	}
+
+	char *end = nullptr;
+	long jobs = strtol(value, &end, 10);
+
+	if(*value == '\0' || *end != '\0' || jobs <= 0 || jobs > 1024)
+		return false;
+
+	ojobs = (unsigned)jobs;
+	return true;
+}
+
 int main(int argc, char **argv) {
-	// { "grid", ".gridfile" }
-	if(argc <= 1 || argc >= 3) {
+	// { "grid", [ "-j", "N" ], [ "-u" ], ".gridfile" }
+	unsigned jobs = 1;
+	bool update = false;
+	const char *gridfile_arg = nullptr;
+
+	for(int arg = 1; arg < argc; ++arg) {
+		if(strncmp(argv[arg], "-j", 2) == 0) {
+			if(!read_jobs(argc, argv, arg, jobs)) {
+				print_usage();
+				return -1;
+			}
+
+			continue;
+		}
+
+		if(strcmp(argv[arg], "-u") == 0) {
+			update = true;
+			continue;
+		}
+
+		if(gridfile_arg) {
+			print_usage();
+			return -1;
+		}
+
+		gridfile_arg = argv[arg];
+	}
+
+	if(!gridfile_arg) {
 		print_usage();
 		return -1;
 	}
 
-	std::filesystem::path gridfile = argv[1];
+	std::filesystem::path gridfile = gridfile_arg;
 
 	if(!std::filesystem::is_regular_file(gridfile)) {
-		fprintf(stderr, "grid: invalid file: %s\n", argv[1]);
+		fprintf(stderr, "grid: invalid file: %s\n", gridfile_arg);
 		return -1;
 	}
 
-	if(!image(gridfile)) {
+	if(!image(gridfile, jobs, update)) {
 		fprintf(stderr, "grid: imaging failed\n");
 		return -1;
 	}
 
 	return 0;
 }
-
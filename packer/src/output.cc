@@ -0,0 +1,192 @@
+#include "output.hh"
+
+#include <stdint.h>
+
+#include <vector>
+
+#if PACKER_POSIX
+	#include <errno.h>
+	#include <fcntl.h>
+	#include <sys/types.h>
+	#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+	#include <sys/sendfile.h>
+#endif
+
+// Plain copies go through a buffer this big
+constexpr size_t COPY_BUFFER_SIZE = 1024 * 1024;
+
+bool Output::open(const std::filesystem::path &ipath) {
+	close();
+
+#if PACKER_POSIX
+	fd = ::open(ipath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	path = ipath;
+	return fd >= 0;
+#else
+	stream.open(ipath, std::ios::binary | std::ios::trunc);
+	return stream.is_open();
+#endif
+}
+
+bool Output::write_at(size_t ioffset, const void *idata, size_t isize) {
+	size_t done = 0;
+
+#if PACKER_POSIX
+	while(done < isize) {
+		ssize_t put = ::pwrite(fd, (const char*)idata + done, isize - done, (off_t)(ioffset + done));
+
+		if(put < 0 && errno == EINTR)
+			continue;
+		if(put <= 0)
+			return false;
+
+		done += (size_t)put;
+	}
+#else
+	std::lock_guard<std::mutex> lock(mutex);
+
+	stream.seekp(ioffset, std::ios::beg);
+	stream.write((const char*)idata, isize);
+
+	if(!stream)
+		return false;
+
+	done = isize;
+#endif
+
+	return done == isize;
+}
+
+bool Output::close(void) {
+#if PACKER_POSIX
+	if(fd < 0)
+		return true;
+
+	bool closed = ::close(fd) == 0;
+	fd = -1;
+	return closed;
+#else
+	if(!stream.is_open())
+		return true;
+
+	stream.close();
+	return !stream.fail();
+#endif
+}
+
+#if defined(__linux__)
+// Copy with copy_file_range, both offsets are explicit, so
+// nothing is shared with other threads, stops at the first error
+static bool copy_file_range_at(int iin, int iout, size_t &uin_offset, size_t &uout_offset, size_t &urest) {
+	while(urest > 0) {
+		loff_t in_offset = (loff_t)uin_offset;
+		loff_t out_offset = (loff_t)uout_offset;
+
+		ssize_t copied = ::copy_file_range(iin, &in_offset, iout, &out_offset, urest, 0);
+
+		if(copied < 0 && errno == EINTR)
+			continue;
+		if(copied <= 0)
+			return false;
+
+		uin_offset += (size_t)copied;
+		uout_offset += (size_t)copied;
+		urest -= (size_t)copied;
+	}
+
+	return true;
+}
+
+// Copy with sendfile, it writes at the file position, so the
+// image is opened once more to get a position of its own
+static bool sendfile_at(int iin, const std::filesystem::path &iout_path, size_t &uin_offset, size_t &uout_offset, size_t &urest) {
+	int out = ::open(iout_path.c_str(), O_WRONLY);
+	if(out < 0)
+		return false;
+
+	if(::lseek(out, (off_t)uout_offset, SEEK_SET) < 0) {
+		::close(out);
+		return false;
+	}
+
+	while(urest > 0) {
+		off_t in_offset = (off_t)uin_offset;
+
+		ssize_t copied = ::sendfile(out, iin, &in_offset, urest);
+
+		if(copied < 0 && errno == EINTR)
+			continue;
+		if(copied <= 0)
+			break;
+
+		uin_offset += (size_t)copied;
+		uout_offset += (size_t)copied;
+		urest -= (size_t)copied;
+	}
+
+	::close(out);
+	return urest == 0;
+}
+#endif
+
+bool Output::copy_at(size_t ioffset, const std::filesystem::path &ipath, size_t ifrom, size_t isize) {
+#if PACKER_POSIX
+	int in = ::open(ipath.c_str(), O_RDONLY);
+	if(in < 0)
+		return false;
+
+	size_t in_offset = ifrom;
+	size_t rest = isize;
+
+	#if defined(__linux__)
+	// each way picks up where the one before it gave up, a file that
+	// ran out early makes them all give up and leaves rest behind
+	if(!copy_file_range_at(in, fd, in_offset, ioffset, rest))
+		sendfile_at(in, path, in_offset, ioffset, rest);
+	#endif
+
+	if(rest > 0) {
+		std::vector<uint8_t> buffer(rest < COPY_BUFFER_SIZE ? rest : COPY_BUFFER_SIZE);
+
+		while(rest > 0) {
+			size_t to_read = rest < buffer.size() ? rest : buffer.size();
+			ssize_t got = ::pread(in, buffer.data(), to_read, (off_t)in_offset);
+
+			if(got < 0 && errno == EINTR)
+				continue;
+			if(got <= 0 || !write_at(ioffset, buffer.data(), (size_t)got))
+				break;
+
+			in_offset += (size_t)got;
+			ioffset += (size_t)got;
+			rest -= (size_t)got;
+		}
+	}
+
+	::close(in);
+	return rest == 0;
+#else
+	std::ifstream in(ipath, std::ios::binary);
+	if(!in.is_open() || !in.seekg(ifrom))
+		return false;
+
+	std::vector<uint8_t> buffer(isize < COPY_BUFFER_SIZE ? isize : COPY_BUFFER_SIZE);
+	size_t rest = isize;
+
+	while(rest > 0) {
+		size_t to_read = rest < buffer.size() ? rest : buffer.size();
+		in.read((char*)buffer.data(), to_read);
+
+		if((size_t)in.gcount() != to_read || !write_at(ioffset, buffer.data(), to_read))
+			return false;
+
+		ioffset += to_read;
+		rest -= to_read;
+	}
+
+	return true;
+#endif
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <stddef.h>
+
+#include <filesystem>
+
+#if defined(__unix__) || defined(__APPLE__)
+	#define PACKER_POSIX 1
+#else
+	#define PACKER_POSIX 0
+
+	#include <fstream>
+	#include <mutex>
+#endif
+
+// Output image that can be written at any offset by many threads at once
+struct Output {
+#if PACKER_POSIX
+	int fd = -1;
+	std::filesystem::path path;
+#else
+	// No positional writes here, so a single stream is shared under a lock
+	std::mutex mutex;
+	std::ofstream stream;
+#endif
+
+	bool open(const std::filesystem::path &ipath);
+
+	// Write all of isize bytes at ioffset
+	bool write_at(size_t ioffset, const void *idata, size_t isize);
+
+	// Copy isize bytes of a file, from ifrom on, to ioffset, in the
+	// kernel where possible, fails if the file is shorter than that
+	bool copy_at(size_t ioffset, const std::filesystem::path &ipath, size_t ifrom, size_t isize);
+
+	bool close(void);
+
+	Output(void) = default;
+
+	Output(const Output &) = delete;
+	Output& operator=(const Output &) = delete;
+
+	~Output(void) { close(); }
+};